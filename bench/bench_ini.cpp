@@ -0,0 +1,139 @@
+// Mikrobenchmark parsera INI: zapisuje tysiące plików motywów do katalogu
+// tymczasowego i parsuje je dawną pętlą getline/substr/stod oraz IniParser.
+#include "../ini_parser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <filesystem>
+
+struct Color {
+    double red = 0, green = 0, blue = 0, alpha = 0;
+};
+
+struct Theme {
+    std::string name;
+    Color foreground, background, palette[16];
+};
+
+static std::string format_color(std::mt19937 &rng) {
+    char text[64];
+    snprintf(text, sizeof(text), "%f,%f,%f,%f", (rng() % 1000) / 1000.0, (rng() % 1000) / 1000.0,
+             (rng() % 1000) / 1000.0, 1.0);
+    return text;
+}
+
+// Pętla w postaci sprzed wspólnego parsera (alokacja na każdy klucz i wartość)
+static void legacy_parse_color(const std::string &color_str, Color &color) {
+    std::istringstream ss(color_str);
+    std::string token;
+    if (std::getline(ss, token, ',')) color.red = std::stod(token);
+    if (std::getline(ss, token, ',')) color.green = std::stod(token);
+    if (std::getline(ss, token, ',')) color.blue = std::stod(token);
+    if (std::getline(ss, token, ',')) color.alpha = std::stod(token);
+}
+
+static bool legacy_parse(const std::string &path, Theme &theme) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    std::string line, section;
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        if (line[0] == '[' && line[line.length() - 1] == ']') {
+            section = line.substr(1, line.length() - 2);
+            continue;
+        }
+        size_t pos = line.find('=');
+        if (pos == std::string::npos) continue;
+        std::string key = line.substr(0, pos);
+        std::string value = line.substr(pos + 1);
+        if (section == "Theme") {
+            if (key == "name") theme.name = value;
+            else if (key == "foreground") legacy_parse_color(value, theme.foreground);
+            else if (key == "background") legacy_parse_color(value, theme.background);
+        } else if (section == "Palette" && key.length() > 5 && key.substr(0, 5) == "color") {
+            int index = std::stoi(key.substr(5));
+            if (index >= 0 && index < 16) legacy_parse_color(value, theme.palette[index]);
+        }
+    }
+    return true;
+}
+
+static void parse_color(IniParser &ini, const IniParser::Entry &entry, Color &color) {
+    double components[4] = {color.red, color.green, color.blue, color.alpha};
+    if (ini.to_double_list(entry, components, 3, 4)) {
+        color = {components[0], components[1], components[2], components[3]};
+    }
+}
+
+static bool ini_parse(IniParser &ini, const std::string &path, Theme &theme) {
+    if (!ini.load_file(path)) return false;
+    IniParser::Entry entry;
+    while (ini.next(entry)) {
+        if (entry.section == "Theme") {
+            if (entry.key == "name") theme.name = entry.value;
+            else if (entry.key == "foreground") parse_color(ini, entry, theme.foreground);
+            else if (entry.key == "background") parse_color(ini, entry, theme.background);
+        } else if (entry.section == "Palette") {
+            int index;
+            if (IniParser::key_suffix(entry.key, "color", index) && index >= 0 && index < 16) {
+                parse_color(ini, entry, theme.palette[index]);
+            }
+        }
+    }
+    return ini.errors().empty();
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 5000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    
+    std::string dir = std::filesystem::temp_directory_path().string() + "/lum-bench-ini-" + std::to_string(getpid());
+    std::filesystem::create_directories(dir);
+    
+    std::mt19937 rng(1);
+    std::vector<std::string> paths;
+    for (int i = 0; i < count; i++) {
+        std::string path = dir + "/theme" + std::to_string(i) + ".theme";
+        std::ofstream file(path);
+        file << "[Theme]\nname=Theme " << i << "\nforeground=" << format_color(rng)
+             << "\nbackground=" << format_color(rng) << "\ntransparency=0.000000\n\n[Palette]\n";
+        for (int c = 0; c < 16; c++) {
+            file << "color" << c << "=" << format_color(rng) << "\n";
+        }
+        paths.push_back(path);
+    }
+    
+    // Najlepszy z kilku przebiegów, pliki są już w pamięci podręcznej systemu
+    auto measure = [&](auto parse) {
+        double best = 1e9;
+        for (int round = 0; round < rounds; round++) {
+            auto start = std::chrono::steady_clock::now();
+            for (const auto &path : paths) {
+                Theme theme;
+                if (!parse(path, theme)) {
+                    std::cerr << "Parse failed: " << path << std::endl;
+                    exit(1);
+                }
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    };
+    
+    double legacy = measure([](const std::string &path, Theme &theme) { return legacy_parse(path, theme); });
+    IniParser ini;
+    double parser = measure([&ini](const std::string &path, Theme &theme) { return ini_parse(ini, path, theme); });
+    
+    printf("Theme parsing, %d files, best of %d rounds\n", count, rounds);
+    printf("%-22s %10.1f ms %8.2f us/file\n", "getline/stod (old)", legacy * 1000, legacy * 1e6 / count);
+    printf("%-22s %10.1f ms %8.2f us/file\n", "IniParser", parser * 1000, parser * 1e6 / count);
+    
+    std::filesystem::remove_all(dir);
+    return 0;
+}
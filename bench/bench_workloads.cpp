@@ -0,0 +1,186 @@
+// Generator syntetycznych obciążeń dla `make bench`.
+// Zapisuje pliki asciicast v2, które lum-terminal odtwarza przez --replay-fast.
+// Dane są deterministyczne (stałe ziarno), więc wyniki kolejnych buildów są porównywalne.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <random>
+#include <fstream>
+#include <iostream>
+
+static const int COLUMNS = 120;
+static const int ROWS = 40;
+static const size_t EVENT_SIZE = 4096;  // mniej więcej tyle daje jeden odczyt z PTY
+
+// Zapis zdarzeń "o" w porcjach po EVENT_SIZE bajtów
+class CastWriter {
+public:
+    CastWriter(const std::string &path) : file(path) {
+        file << "{\"version\": 2, \"width\": " << COLUMNS << ", \"height\": " << ROWS << "}\n";
+    }
+    
+    ~CastWriter() {
+        flush();
+    }
+    
+    bool ok() const {
+        return file.good();
+    }
+    
+    void write(const std::string &data) {
+        pending += data;
+        total += data.size();
+        if (pending.size() >= EVENT_SIZE) {
+            flush();
+        }
+    }
+    
+    size_t size() const {
+        return total;
+    }
+
+private:
+    std::ofstream file;
+    std::string pending;
+    size_t total = 0;
+    
+    void flush() {
+        if (pending.empty()) return;
+        
+        std::string quoted = "\"";
+        for (unsigned char c : pending) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += (char)c;
+            } else if (c < 0x20 || c == 0x7f) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            } else {
+                quoted += (char)c;
+            }
+        }
+        file << "[0.0, \"o\", " << quoted << "\"]\n";
+        pending.clear();
+    }
+};
+
+static const char *WORDS[] = {
+    "request", "kubectl", "pod", "deployment", "error", "warning", "GET", "POST",
+    "/api/v1/items", "200", "503", "latency", "ms", "user", "session", "cache",
+};
+
+static std::string random_words(std::mt19937 &rng, int count) {
+    std::string line;
+    for (int i = 0; i < count; i++) {
+        if (i > 0) line += ' ';
+        line += WORDS[rng() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+    }
+    return line;
+}
+
+// Duży zrzut zwykłego tekstu (np. kubectl logs)
+static void plain_text(CastWriter &out, size_t target) {
+    std::mt19937 rng(1);
+    for (int n = 0; out.size() < target; n++) {
+        out.write("2024-01-01T00:00:00Z " + std::to_string(n) + " " + random_words(rng, 12) + "\r\n");
+    }
+}
+
+// Gęste zmiany kolorów SGR (256 kolorów, truecolor, pogrubienie, podkreślenie)
+static void sgr_colors(CastWriter &out, size_t target) {
+    std::mt19937 rng(2);
+    while (out.size() < target) {
+        std::string line;
+        for (int i = 0; i < 12; i++) {
+            switch (rng() % 4) {
+            case 0: line += "\x1b[38;5;" + std::to_string(rng() % 256) + "m"; break;
+            case 1: line += "\x1b[48;5;" + std::to_string(rng() % 256) + "m"; break;
+            case 2:
+                line += "\x1b[38;2;" + std::to_string(rng() % 256) + ";" + std::to_string(rng() % 256) + ";" +
+                        std::to_string(rng() % 256) + "m";
+                break;
+            case 3: line += (rng() % 2) ? "\x1b[1m" : "\x1b[4m"; break;
+            }
+            line += random_words(rng, 1) + " ";
+        }
+        out.write(line + "\x1b[0m\r\n");
+    }
+}
+
+// Tekst z CJK, emoji i znakami łączonymi
+static void unicode_text(CastWriter &out, size_t target) {
+    static const char *PIECES[] = {
+        "日本語のテキスト", "中文字符测试", "한국어 문장", "Zażółć gęślą jaźń", "e\xcc\x81\xcc\x82",
+        "\xf0\x9f\x98\x80", "\xf0\x9f\x9a\x80", "Ελληνικά", "кириллица", "עברית",
+    };
+    std::mt19937 rng(3);
+    while (out.size() < target) {
+        std::string line;
+        for (int i = 0; i < 8; i++) {
+            line += PIECES[rng() % (sizeof(PIECES) / sizeof(PIECES[0]))];
+            line += ' ';
+        }
+        out.write(line + "\r\n");
+    }
+}
+
+// Pełnoekranowe przerysowania z adresowaniem kursora (jak htop)
+static void cursor_redraws(CastWriter &out, size_t target) {
+    std::mt19937 rng(4);
+    out.write("\x1b[?1049h\x1b[?25l");
+    while (out.size() < target) {
+        std::string frame = "\x1b[H";
+        for (int row = 1; row <= ROWS; row++) {
+            frame += "\x1b[" + std::to_string(row) + ";1H";
+            int bar = rng() % (COLUMNS - 20);
+            frame += "\x1b[32m" + std::string(bar, '|') + "\x1b[0m" + std::string(COLUMNS - 20 - bar, ' ');
+            char value[24];
+            snprintf(value, sizeof(value), "%5.1f%% %8u", (rng() % 1000) / 10.0, (unsigned)(rng() % 100000000));
+            frame += value;
+            frame += "\x1b[K";
+        }
+        out.write(frame);
+    }
+    out.write("\x1b[?25h\x1b[?1049l");
+}
+
+// Dużo krótkich linii, które wypychają historię (scrollback)
+static void scrollback_lines(CastWriter &out, size_t target) {
+    for (int n = 0; out.size() < target; n++) {
+        out.write("line " + std::to_string(n) + "\r\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " OUTPUT_DIR [SIZE_MB]" << std::endl;
+        return 1;
+    }
+    
+    std::string dir = argv[1];
+    size_t size = (argc > 2 ? atol(argv[2]) : 16) * 1024 * 1024;
+    
+    struct Workload {
+        const char *name;
+        void (*generate)(CastWriter &, size_t);
+    };
+    const Workload workloads[] = {
+        {"plain-text", plain_text},
+        {"sgr-colors", sgr_colors},
+        {"unicode-cjk", unicode_text},
+        {"cursor-redraw", cursor_redraws},
+        {"scrollback", scrollback_lines},
+    };
+    
+    for (const auto &workload : workloads) {
+        std::string path = dir + "/" + workload.name + ".cast";
+        CastWriter out(path);
+        if (!out.ok()) {
+            std::cerr << "Cannot write " << path << std::endl;
+            return 1;
+        }
+        workload.generate(out, size);
+    }
+    return 0;
+}
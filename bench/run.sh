@@ -0,0 +1,88 @@
+#!/bin/bash
+
+# Benchmark runner for Lum Terminal
+# Usage: bench/run.sh TERMINAL_BINARY WORKLOAD_DIR
+#
+# Every workload is replayed with --replay-fast BENCH_RUNS times (default 3)
+# and the best run is reported. Without a display the runs go through
+# xvfb-run, or through the GTK broadway backend if Xvfb is not installed.
+# With BENCH_HEADLESS=1 (the default) the terminal renders offscreen
+# (--headless); BENCH_HEADLESS=0 uses a normal window. BENCH_RENDER_PATH=alpha
+# forces the RGBA visual and alpha compositing, to compare with the default
+# opaque path (render_path=auto with transparency 0).
+
+TERMINAL="$1"
+WORKLOAD_DIR="$2"
+RUNS="${BENCH_RUNS:-3}"
+RENDER_PATH="${BENCH_RENDER_PATH:-auto}"
+HEADLESS=()
+if [ "${BENCH_HEADLESS:-1}" = "1" ]; then
+    HEADLESS=(--headless)
+fi
+
+if [ ! -x "$TERMINAL" ] || [ ! -d "$WORKLOAD_DIR" ]; then
+    echo "Usage: $0 TERMINAL_BINARY WORKLOAD_DIR" >&2
+    exit 1
+fi
+
+# Isolated configuration, cache and data, so user settings and themes do not skew results
+BENCH_HOME=$(mktemp -d)
+trap 'kill $BROADWAY_PID 2>/dev/null; rm -rf "$BENCH_HOME"' EXIT
+export HOME="$BENCH_HOME"
+export XDG_CONFIG_HOME="$BENCH_HOME/config"
+export XDG_CACHE_HOME="$BENCH_HOME/cache"
+export XDG_DATA_HOME="$BENCH_HOME/data"
+mkdir -p "$BENCH_HOME/.config/lum-terminal"
+printf '[General]\nrender_path=%s\n' "$RENDER_PATH" > "$BENCH_HOME/.config/lum-terminal/config.ini"
+
+RUNNER=()
+if [ -z "$DISPLAY" ] && [ -z "$WAYLAND_DISPLAY" ]; then
+    if command -v xvfb-run >/dev/null 2>&1; then
+        RUNNER=(xvfb-run -a -s "-screen 0 1920x1080x24")
+    elif command -v broadwayd >/dev/null 2>&1; then
+        broadwayd :5 >/dev/null 2>&1 &
+        BROADWAY_PID=$!
+        sleep 1
+        export GDK_BACKEND=broadway
+        export BROADWAY_DISPLAY=:5
+    else
+        echo "No display available. Install Xvfb (xvfb-run) or broadwayd." >&2
+        exit 1
+    fi
+fi
+
+echo "Lum Terminal benchmark ($(git -C "$(dirname "$0")/.." rev-parse --short HEAD 2>/dev/null || echo unknown), best of $RUNS runs, render_path=$RENDER_PATH)"
+printf "%-16s %10s %10s %10s %8s %10s %12s\n" "workload" "MB" "seconds" "MB/s" "frames" "RSS MB" "draw p95 ms"
+
+STATUS=0
+for cast in "$WORKLOAD_DIR"/*.cast; do
+    name=$(basename "$cast" .cast)
+    best=""
+    for ((run = 0; run < RUNS; run++)); do
+        # Replay: N bytes in S s (X MB/s), F frames, peak RSS R MB
+        # Replay timing: D draws, draw p50 A ms, p95 B ms, ...
+        output=$("${RUNNER[@]}" "$TERMINAL" --replay "$cast" --replay-fast "${HEADLESS[@]}" 2>/dev/null)
+        line=$(echo "$output" | grep '^Replay:')
+        if [ -z "$line" ]; then
+            continue
+        fi
+        read -r bytes seconds frames rss <<< "$(echo "$line" | sed -E 's/^Replay: ([0-9]+) bytes in ([0-9.]+) s \([0-9.]+ MB\/s\), ([0-9]+) frames, peak RSS ([0-9.]+) MB$/\1 \2 \3 \4/')"
+        draw_p95=$(echo "$output" | sed -nE 's/^Replay timing: .* p95 ([0-9.]+) ms, max .*/\1/p')
+        if [ -z "$best" ] || awk -v a="$seconds" -v b="$best_seconds" 'BEGIN { exit !(a < b) }'; then
+            best="$bytes $seconds $frames $rss ${draw_p95:--}"
+            best_seconds="$seconds"
+        fi
+    done
+    
+    if [ -z "$best" ]; then
+        printf "%-16s %10s\n" "$name" "FAILED"
+        STATUS=1
+        continue
+    fi
+    
+    read -r bytes seconds frames rss draw_p95 <<< "$best"
+    awk -v name="$name" -v bytes="$bytes" -v seconds="$seconds" -v frames="$frames" -v rss="$rss" -v draw="$draw_p95" \
+        'BEGIN { mb = bytes / 1048576; printf "%-16s %10.1f %10.3f %10.1f %8d %10.1f %12s\n", name, mb, seconds, mb / seconds, frames, rss, draw }'
+done
+
+exit $STATUS
@@ -0,0 +1,187 @@
+#ifndef LUM_INI_PARSER_H
+#define LUM_INI_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Parser for the INI files of Lum Terminal (config.ini and *.theme).
+// A file is read with a single read() into one buffer. Sections, keys and
+// values are string_views into that buffer, and numbers are converted with
+// std::from_chars, so a line costs no allocation and the result does not
+// depend on LC_NUMERIC. Bad lines and values are collected as
+// "path:line: message" instead of throwing, so a broken theme cannot abort
+// startup.
+class IniParser {
+public:
+    struct Entry {
+        std::string_view section;
+        std::string_view key;
+        std::string_view value;
+        int line;
+    };
+
+    // Wczytuje cały plik jednym odczytem; false, gdy pliku nie da się odczytać
+    bool load_file(const std::string &path) {
+        file_path = path;
+        buffer.clear();
+        reset("");
+
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok) {
+            buffer.resize(st.st_size);
+            size_t filled = 0;
+            while (filled < buffer.size()) {
+                ssize_t length = read(fd, &buffer[filled], buffer.size() - filled);
+                if (length < 0 && errno == EINTR) continue;
+                if (length <= 0) break;
+                filled += length;
+            }
+            buffer.resize(filled);  // plik mógł się skrócić w trakcie odczytu
+        }
+        ::close(fd);
+
+        reset(buffer);
+        return ok;
+    }
+
+    // Tekst należy do wywołującego i musi żyć dłużej niż parser
+    void load_text(std::string_view text, const std::string &name = "") {
+        file_path = name;
+        reset(text);
+    }
+
+    // Następna para klucz=wartość; puste linie, komentarze (# i ;) oraz
+    // nagłówki sekcji są pomijane
+    bool next(Entry &entry) {
+        while (position < text.size()) {
+            size_t end = text.find('\n', position);
+            if (end == std::string_view::npos) end = text.size();
+            std::string_view line = trim(text.substr(position, end - position));
+            position = end + 1;
+            line_number++;
+
+            if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+
+            if (line[0] == '[') {
+                if (line.back() != ']') {
+                    add_error(line_number, "unterminated section header");
+                    continue;
+                }
+                section = trim(line.substr(1, line.size() - 2));
+                continue;
+            }
+
+            size_t equals = line.find('=');
+            if (equals == std::string_view::npos) {
+                add_error(line_number, "expected key=value");
+                continue;
+            }
+
+            entry.section = section;
+            entry.key = trim(line.substr(0, equals));
+            entry.value = trim(line.substr(equals + 1));
+            entry.line = line_number;
+            return true;
+        }
+        return false;
+    }
+
+    bool to_int(const Entry &entry, int &result) {
+        if (parse_number(entry.value, result)) return true;
+        add_error(entry.line, "'" + std::string(entry.key) + "' is not an integer");
+        return false;
+    }
+
+    bool to_double(const Entry &entry, double &result) {
+        if (parse_number(entry.value, result)) return true;
+        add_error(entry.line, "'" + std::string(entry.key) + "' is not a number");
+        return false;
+    }
+
+    // Lista liczb rozdzielonych przecinkami (np. kolor "r,g,b,a"); wyniki
+    // trafiają do values dopiero, gdy cała lista jest poprawna
+    bool to_double_list(const Entry &entry, double *values, size_t min_count, size_t max_count) {
+        double parsed[16];
+        size_t count = 0;
+        std::string_view rest = entry.value;
+        bool ok = max_count <= 16;
+        while (ok) {
+            size_t comma = rest.find(',');
+            ok = count < max_count && parse_number(trim(rest.substr(0, comma)), parsed[count]);
+            count++;
+            if (comma == std::string_view::npos) break;
+            rest = rest.substr(comma + 1);
+        }
+
+        if (!ok || count < min_count) {
+            add_error(entry.line, "'" + std::string(entry.key) + "' expects " + std::to_string(min_count) +
+                                  (min_count == max_count ? "" : "-" + std::to_string(max_count)) +
+                                  " comma-separated numbers");
+            return false;
+        }
+        std::copy(parsed, parsed + count, values);
+        return true;
+    }
+
+    // Liczba na końcu klucza, np. 12 dla "color12"
+    static bool key_suffix(std::string_view key, std::string_view prefix, int &result) {
+        return key.size() > prefix.size() && key.substr(0, prefix.size()) == prefix &&
+               parse_number(key.substr(prefix.size()), result);
+    }
+
+    void add_error(int line, const std::string &message) {
+        error_list.push_back(file_path + ":" + std::to_string(line) + ": " + message);
+    }
+
+    const std::vector<std::string> &errors() const {
+        return error_list;
+    }
+
+private:
+    std::string file_path;
+    std::string buffer;
+    std::string_view text;
+    std::string_view section;
+    size_t position = 0;
+    int line_number = 0;
+    std::vector<std::string> error_list;
+
+    void reset(std::string_view new_text) {
+        text = new_text;
+        section = std::string_view();
+        position = 0;
+        line_number = 0;
+        error_list.clear();
+    }
+
+    static std::string_view trim(std::string_view value) {
+        size_t start = value.find_first_not_of(" \t\r");
+        if (start == std::string_view::npos) return std::string_view();
+        size_t end = value.find_last_not_of(" \t\r");
+        return value.substr(start, end - start + 1);
+    }
+
+    template <typename Number>
+    static bool parse_number(std::string_view value, Number &result) {
+        // Wynik jest zmieniany tylko wtedy, gdy cała wartość jest liczbą
+        Number number;
+        const char *end = value.data() + value.size();
+        auto parsed = std::from_chars(value.data(), end, number);
+        if (value.empty() || parsed.ec != std::errc() || parsed.ptr != end) return false;
+        result = number;
+        return true;
+    }
+};
+
+#endif
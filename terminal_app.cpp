@@ -1,17 +1,163 @@
 #include <gtk/gtk.h>
 #include <vte/vte.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
+#define PCRE2_CODE_UNIT_WIDTH 0
+#include <pcre2.h>
 #include <stdlib.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <cstdlib>
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <chrono>
+#include <cmath>
+
+#include "ini_parser.h"
+
+// Startup phase profiler enabled with --profile-startup.
+// Phases are measured relative to entering main() and reported once the first
+// frame is painted and the first shell has been spawned.
+class StartupProfiler {
+public:
+    // Measures a single phase from construction to destruction
+    class Scope {
+    public:
+        Scope(const std::string &phase) : phase(phase), start(g_get_monotonic_time()) {}
+        ~Scope() { StartupProfiler::record(phase, start, g_get_monotonic_time()); }
+    private:
+        std::string phase;
+        gint64 start;
+    };
+
+    static void enable(bool json_output) {
+        enabled = true;
+        json = json_output;
+    }
+
+    static void set_origin(gint64 time) {
+        origin = time;
+    }
+
+    static bool is_active() {
+        return enabled && !reported;
+    }
+
+    static void record(const std::string &phase, gint64 start, gint64 end) {
+        if (!is_active()) return;
+        phases.push_back({phase, start, end});
+    }
+
+    // Records a momentary event (e.g. completion of an asynchronous operation)
+    static void mark(const std::string &phase) {
+        gint64 now = g_get_monotonic_time();
+        record(phase, now, now);
+    }
+
+    static void mark_first_frame() {
+        if (!is_active() || first_frame_seen) return;
+        mark("first frame painted");
+        first_frame_seen = true;
+        report_if_complete();
+    }
+
+    static void mark_shell_spawned() {
+        if (!is_active() || shell_spawned) return;
+        mark("vte_terminal_spawn_async completed");
+        shell_spawned = true;
+        report_if_complete();
+    }
+
+private:
+    struct Phase {
+        std::string name;
+        gint64 start;
+        gint64 end;
+    };
+
+    static inline bool enabled = false;
+    static inline bool json = false;
+    static inline bool reported = false;
+    static inline bool first_frame_seen = false;
+    static inline bool shell_spawned = false;
+    static inline gint64 origin = 0;
+    static inline std::vector<Phase> phases;
+
+    static void report_if_complete() {
+        if (first_frame_seen && shell_spawned) {
+            report();
+        }
+    }
+
+    // Nazwy faz zawierają nazwy plików motywów: UTF-8 przechodzi bez zmian,
+    // niepoprawne bajty stają się U+FFFD, a znaki sterujące - sekwencjami \uXXXX
+    static std::string json_string(const std::string &text) {
+        gchar *valid = g_utf8_make_valid(text.c_str(), text.size());
+        std::string out = "\"";
+        for (const char *p = valid; *p; p++) {
+            unsigned char c = *p;
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+        g_free(valid);
+        return out + "\"";
+    }
+
+    static void report() {
+        reported = true;
+        
+        if (json) {
+            // JSON na stdout, żeby skrypty porównujące wydania mogły go łatwo przechwycić
+            std::cout << "{\"phases\":[";
+            for (size_t i = 0; i < phases.size(); i++) {
+                std::cout << (i > 0 ? "," : "")
+                          << "{\"name\":" << json_string(phases[i].name)
+                          << ",\"start_ms\":" << (phases[i].start - origin) / 1000.0
+                          << ",\"duration_ms\":" << (phases[i].end - phases[i].start) / 1000.0 << "}";
+            }
+            std::cout << "]}" << std::endl;
+            return;
+        }
+        
+        g_printerr("%-48s %10s %10s\n", "Startup phase", "start ms", "took ms");
+        for (const auto &phase : phases) {
+            g_printerr("%-48s %10.2f %10.2f\n", phase.name.c_str(),
+                       (phase.start - origin) / 1000.0, (phase.end - phase.start) / 1000.0);
+        }
+    }
+};
 
 // Color theme structure
 struct ColorTheme {
@@ -22,14 +168,359 @@ struct ColorTheme {
     double transparency;
 };
 
+// Writes a file through a temporary file and rename(), so a crash never leaves
+// a half-written file behind
+static bool write_file_atomically(const std::string &path, const std::string &contents) {
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    
+    const char *data = contents.data();
+    size_t remaining = contents.size();
+    bool ok = true;
+    while (ok && remaining > 0) {
+        ssize_t written = write(fd, data, remaining);
+        if (written < 0 && errno == EINTR) continue;
+        ok = written > 0;
+        if (ok) {
+            data += written;
+            remaining -= written;
+        }
+    }
+    
+    ok = ok && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Compact binary cache of parsed themes stored in $XDG_CACHE_HOME/lum-terminal.
+// Records have a fixed size, so a warm start only maps a single file and copies
+// the colors without any text parsing. The cache is valid only while the mtime
+// of the themes directory and the mtime and size of every theme file match.
+class ThemeCache {
+public:
+    struct Entry {
+        std::string filename;
+        int64_t mtime_ns;
+        int64_t size;
+        ColorTheme theme;
+    };
+
+    static std::string get_cache_path() {
+        return std::string(g_get_user_cache_dir()) + "/lum-terminal/themes.cache";
+    }
+
+    // Returns mtime (in nanoseconds) and size of a file or directory
+    static bool stat_file(const std::string &path, int64_t &mtime_ns, int64_t &size) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+        mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        size = st.st_size;
+        return true;
+    }
+
+    // Fills themes from the cache; returns false if the cache is missing or stale
+    static bool load(const std::string &themes_dir, std::map<std::string, ColorTheme> &themes) {
+        int fd = open(get_cache_path().c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        
+        const Header *header = static_cast<const Header*>(data);
+        const Record *records = reinterpret_cast<const Record*>(header + 1);
+        int64_t dir_mtime, dir_size;
+        
+        bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                     header->version == VERSION &&
+                     header->record_size == sizeof(Record) &&
+                     (size_t)st.st_size == sizeof(Header) + (size_t)header->entry_count * sizeof(Record) &&
+                     stat_file(themes_dir, dir_mtime, dir_size) &&
+                     dir_mtime == header->dir_mtime_ns;
+        
+        // Zmiana katalogu wykrywa dodane i usunięte pliki, a stat każdego pliku - edycje
+        for (uint32_t i = 0; valid && i < header->entry_count; i++) {
+            const Record &record = records[i];
+            int64_t mtime, size;
+            valid = record.filename[sizeof(record.filename) - 1] == '\0' &&
+                    record.name[sizeof(record.name) - 1] == '\0' &&
+                    stat_file(themes_dir + "/" + record.filename, mtime, size) &&
+                    mtime == record.mtime_ns && size == record.size;
+        }
+        
+        if (valid) {
+            for (uint32_t i = 0; i < header->entry_count; i++) {
+                const Record &record = records[i];
+                if (record.name[0] == '\0') continue;
+                
+                ColorTheme theme;
+                theme.name = record.name;
+                theme.foreground = record.foreground;
+                theme.background = record.background;
+                memcpy(theme.palette, record.palette, sizeof(theme.palette));
+                theme.transparency = record.transparency;
+                themes[theme.name] = theme;
+            }
+        }
+        
+        munmap(data, st.st_size);
+        return valid;
+    }
+
+    // Writes the cache atomically (temporary file + rename)
+    static void store(int64_t dir_mtime_ns, const std::vector<Entry> &entries) {
+        std::vector<Record> records(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            const Entry &entry = entries[i];
+            Record &record = records[i];
+            
+            // Nazwy, które się nie mieszczą, wymuszają parsowanie plików tekstowych
+            if (entry.filename.size() >= sizeof(record.filename) || entry.theme.name.size() >= sizeof(record.name)) {
+                invalidate();
+                return;
+            }
+            
+            memset(&record, 0, sizeof(record));
+            memcpy(record.filename, entry.filename.c_str(), entry.filename.size());
+            memcpy(record.name, entry.theme.name.c_str(), entry.theme.name.size());
+            record.mtime_ns = entry.mtime_ns;
+            record.size = entry.size;
+            record.foreground = entry.theme.foreground;
+            record.background = entry.theme.background;
+            memcpy(record.palette, entry.theme.palette, sizeof(record.palette));
+            record.transparency = entry.theme.transparency;
+        }
+        
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.record_size = sizeof(Record);
+        header.entry_count = records.size();
+        header.dir_mtime_ns = dir_mtime_ns;
+        
+        std::string cache_path = get_cache_path();
+        gchar *cache_dir = g_path_get_dirname(cache_path.c_str());
+        g_mkdir_with_parents(cache_dir, 0700);
+        g_free(cache_dir);
+        
+        std::string contents(reinterpret_cast<const char*>(&header), sizeof(header));
+        contents.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+        
+        if (!write_file_atomically(cache_path, contents)) {
+            std::cerr << "Cannot write theme cache: " << cache_path << std::endl;
+        }
+    }
+
+    static void invalidate() {
+        unlink(get_cache_path().c_str());
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'L', 'U', 'M', 'T', 'H', 'C', 'A', '1'};
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint32_t entry_count;
+        uint32_t reserved;
+        int64_t dir_mtime_ns;
+    };
+
+    struct Record {
+        char filename[256];
+        char name[256];
+        int64_t mtime_ns;
+        int64_t size;
+        GdkRGBA foreground;
+        GdkRGBA background;
+        GdkRGBA palette[16];
+        double transparency;
+    };
+};
+
+// Key bindings compiled into one hash table keyed by (modifiers, keyval), so a
+// key that is not bound costs a single lookup before it goes to the terminal.
+// The defaults can be changed in the [Keybindings] section of config.ini, for
+// example split_right=<Control><Alt>backslash. Several accelerators are
+// separated by ',' and an empty value unbinds the action.
+class Keymap {
+public:
+    enum class Action {
+        None,
+        NewTab,
+        ClosePane,
+        SplitRight,
+        SplitDown,
+        FocusPaneLeft,
+        FocusPaneRight,
+        FocusPaneUp,
+        FocusPaneDown,
+        NextTab,
+        PreviousTab,
+        FontLarger,
+        FontSmaller,
+        FontReset,
+        ZoomIn,
+        ZoomOut,
+        ZoomReset,
+        Search,
+        ToggleBroadcast,
+    };
+    
+    struct ActionInfo {
+        Action action;
+        const char *name;
+        const char *default_accelerators;
+    };
+    
+    static constexpr ActionInfo ACTIONS[] = {
+        {Action::NewTab, "new_tab", "<Control><Shift>t"},
+        {Action::ClosePane, "close_pane", "<Control><Shift>w"},
+        {Action::SplitRight, "split_right", "<Control><Shift>e"},
+        {Action::SplitDown, "split_down", "<Control><Shift>o"},
+        {Action::FocusPaneLeft, "focus_pane_left", "<Alt>Left"},
+        {Action::FocusPaneRight, "focus_pane_right", "<Alt>Right"},
+        {Action::FocusPaneUp, "focus_pane_up", "<Alt>Up"},
+        {Action::FocusPaneDown, "focus_pane_down", "<Alt>Down"},
+        {Action::NextTab, "next_tab", "<Control>Page_Down"},
+        {Action::PreviousTab, "previous_tab", "<Control>Page_Up"},
+        {Action::FontLarger, "font_larger", "<Control>plus,<Control><Shift>plus,<Control>equal,<Control>KP_Add"},
+        {Action::FontSmaller, "font_smaller", "<Control>minus,<Control>KP_Subtract"},
+        {Action::FontReset, "font_reset", "<Control>0,<Control>KP_0"},
+        {Action::ZoomIn, "zoom_in", ""},
+        {Action::ZoomOut, "zoom_out", ""},
+        {Action::ZoomReset, "zoom_reset", ""},
+        {Action::Search, "search", "<Control><Shift>f"},
+        {Action::ToggleBroadcast, "toggle_broadcast", "<Control><Shift>b"},
+    };
+    
+    // Builds the table from the defaults and the [Keybindings] overrides
+    // (action name -> accelerators); problems are returned as messages
+    std::vector<std::string> compile(const std::map<std::string, std::string> &overrides) {
+        std::vector<std::string> errors;
+        bindings.clear();
+        
+        for (const auto &override : overrides) {
+            if (!find_action(override.first)) {
+                errors.push_back("unknown action '" + override.first + "'");
+            }
+        }
+        
+        for (const auto &info : ACTIONS) {
+            auto found = overrides.find(info.name);
+            std::string accelerators = found != overrides.end() ? found->second : info.default_accelerators;
+            
+            std::stringstream list(accelerators);
+            std::string accelerator;
+            while (std::getline(list, accelerator, ',')) {
+                if (accelerator.empty()) continue;
+                
+                guint keyval = 0;
+                GdkModifierType modifiers = (GdkModifierType)0;
+                gtk_accelerator_parse(accelerator.c_str(), &keyval, &modifiers);
+                if (keyval == 0) {
+                    errors.push_back("invalid accelerator '" + accelerator + "' for " + info.name);
+                    continue;
+                }
+                bindings[make_key(modifiers, keyval)] = info.action;
+            }
+        }
+        return errors;
+    }
+    
+    Action lookup(guint state, guint keyval) const {
+        auto found = bindings.find(make_key(state, keyval));
+        return found != bindings.end() ? found->second : Action::None;
+    }
+
+private:
+    std::unordered_map<uint64_t, Action> bindings;
+    
+    static const ActionInfo *find_action(const std::string &name) {
+        for (const auto &info : ACTIONS) {
+            if (name == info.name) return &info;
+        }
+        return nullptr;
+    }
+    
+    // NumLock, CapsLock i przyciski myszy nie wpływają na dopasowanie;
+    // Shift+t daje T, więc klawisze są porównywane małymi literami
+    static uint64_t make_key(guint state, guint keyval) {
+        guint modifiers = state & gtk_accelerator_get_default_mod_mask();
+        return ((uint64_t)modifiers << 32) | gdk_keyval_to_lower(keyval);
+    }
+};
+
 // Configuration structure
 struct TerminalConfig {
     std::string font_family = "Monospace";
     double font_size = 11.0;
     double transparency = 0.0;
     std::string current_theme_name = "Default";
+    int scrollback_lines = 10000;          // per-tab line limit
+    int scrollback_budget_mb = 256;        // estimated memory for all tabs together, 0 = no limit
+    bool background_tab_spawn = false;     // start shells of declared tabs at idle priority
+    int scrollback_spill_minutes = 0;      // move scrollback of unviewed tabs to disk, 0 = never
+    bool record_output = false;            // record raw output of new tabs
+    std::string record_dir;                // empty = OutputRecorder::get_default_dir()
+    bool record_timestamps = false;        // also write a scriptreplay timing file
+    bool record_plain_text = false;        // also write output without escape sequences
+    bool record_asciicast = false;         // also write an asciicast v2 file (for --replay)
+    bool latency_probe = false;            // measure keypress-to-frame latency, dumped on SIGUSR1
+    int process_monitor_seconds = 0;       // CPU and memory of each tab's processes in its tooltip, 0 = off
+    std::string render_path = "auto";      // auto: opaque visual while transparency is 0, alpha: always RGBA
+    std::map<std::string, std::string> keybindings;  // [Keybindings]: action -> accelerators, only overrides
+    Keymap keymap;                         // compiled from the defaults and keybindings
     std::map<std::string, ColorTheme> color_themes;
     
+    // Whether windows need the RGBA visual and alpha compositing
+    bool uses_alpha() const {
+        return render_path == "alpha" || transparency > 0.0;
+    }
+    
+    // False while the remaining themes are still being loaded in the background
+    bool themes_complete = true;
+    
+    ~TerminalConfig() {
+        if (theme_loader.joinable()) {
+            theme_loader.join();
+        }
+        
+        // Zapisz zaległe zmiany i zatrzymaj wątek zapisu
+        flush();
+        if (save_worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(save_mutex);
+                save_worker_stop = true;
+            }
+            save_cv.notify_all();
+            save_worker.join();
+        }
+    }
+    
     // Returns path to configuration directory
     static std::string get_config_dir() {
         std::string config_dir = std::string(getenv("HOME")) + "/.config/lum-terminal";
@@ -59,38 +550,91 @@ struct TerminalConfig {
         return get_config_dir() + "/themes";
     }
     
-    // Saving configuration to file
+    // Settings changed: config.ini will be written after the debounce window
+    void mark_settings_dirty() {
+        settings_dirty = true;
+        schedule_save();
+    }
+    
+    // Theme changed: only this theme file will be rewritten
+    void mark_theme_dirty(const std::string &name) {
+        dirty_themes.insert(name);
+        schedule_save();
+    }
+    
+    // Writes a file that is not part of the configuration (e.g. the session)
+    // through the same writer thread
+    void write_file_async(const std::string &path, const std::string &contents) {
+        SaveJob job;
+        job.files.push_back({path, contents});
+        {
+            std::lock_guard<std::mutex> lock(save_mutex);
+            save_queue.push_back(std::move(job));
+            if (!save_worker.joinable()) {
+                save_worker = std::thread(&TerminalConfig::save_worker_loop, this);
+            }
+        }
+        save_cv.notify_all();
+    }
+    
+    // Hands pending changes to the writer thread right away without waiting
+    // for the write and fsync, so the UI thread does not stall
+    void save_pending() {
+        if (save_timeout_id != 0) {
+            g_source_remove(save_timeout_id);
+            save_timeout_id = 0;
+        }
+        save_config();
+    }
+    
+    // Writes pending changes right away and waits for the writer thread
+    // (at process exit, when nothing is drawn any more)
+    void flush() {
+        save_pending();
+        
+        std::unique_lock<std::mutex> lock(save_mutex);
+        save_cv.wait(lock, [this]() { return save_queue.empty() && !save_worker_busy; });
+    }
+    
+    // Saving configuration to file: takes a snapshot of the dirty settings and
+    // themes on the main thread and hands it over to the writer thread
     void save_config() {
-        // Save main configuration file
-        std::ofstream config_file(get_config_path());
-        if (!config_file.is_open()) {
-            std::cerr << "Cannot open configuration file for writing." << std::endl;
+        if (!settings_dirty && dirty_themes.empty()) {
             return;
         }
         
-        // Set precision for floating point numbers
-        config_file.precision(6);
-        config_file << std::fixed;
-        
-        // Saving basic settings
-        config_file << "[General]" << std::endl;
-        config_file << "font_family=" << font_family << std::endl;
-        config_file << "font_size=" << font_size << std::endl;
-        config_file << "transparency=" << transparency << std::endl;
-        config_file << "current_theme=" << current_theme_name << std::endl;
+        SaveJob job;
+        if (settings_dirty) {
+            job.files.push_back({get_config_path(), serialize_settings()});
+            settings_dirty = false;
+        }
         
-        config_file.close();
+        for (const auto &name : dirty_themes) {
+            auto it = color_themes.find(name);
+            if (it != color_themes.end()) {
+                job.files.push_back({get_themes_dir() + "/" + name + ".theme", serialize_theme(it->second)});
+            }
+        }
         
-        // Save each theme as a separate file
-        for (const auto& theme_pair : color_themes) {
-            save_theme(theme_pair.second);
+        if (!dirty_themes.empty()) {
+            // Motywy trafią na dysk, więc cache może powstać bez ich parsowania.
+            // Niepełny katalog motywów unieważniłby go przy odbudowie, a czekanie
+            // na wątek parsujący zablokowałoby pętlę GTK - wtedy odbudowę zleca
+            // on_remaining_themes_loaded.
+            if (themes_complete) {
+                job.refresh_cache = true;
+                job.themes = color_themes;
+            } else {
+                theme_cache_stale = true;
+            }
+            dirty_themes.clear();
         }
         
-        std::cerr << "Configuration saved to " << get_config_path() << std::endl;
+        queue_save_job(std::move(job));
     }
     
     // Inicjalizacja palety kolorów, jeśli jest pusta
-    void initialize_palette_if_empty(ColorTheme *theme) {
+    static void initialize_palette_if_empty(ColorTheme *theme) {
         bool needs_initialization = false;
         
         // Sprawdź, czy pierwszy kolor palety ma zerowe wartości
@@ -166,20 +710,52 @@ struct TerminalConfig {
         }
     }
     
-    // Zapisywanie pojedynczego motywu do pliku
-    void save_theme(const ColorTheme& theme) {
+    // Serializing basic settings in config.ini format
+    std::string serialize_settings() const {
+        std::ostringstream config_file;
+        
+        // Set precision for floating point numbers
+        config_file.precision(6);
+        config_file << std::fixed;
+        
+        // Saving basic settings
+        config_file << "[General]" << std::endl;
+        config_file << "font_family=" << font_family << std::endl;
+        config_file << "font_size=" << font_size << std::endl;
+        config_file << "transparency=" << transparency << std::endl;
+        config_file << "current_theme=" << current_theme_name << std::endl;
+        config_file << "scrollback_lines=" << scrollback_lines << std::endl;
+        config_file << "scrollback_budget_mb=" << scrollback_budget_mb << std::endl;
+        config_file << "background_tab_spawn=" << (background_tab_spawn ? "true" : "false") << std::endl;
+        config_file << "scrollback_spill_minutes=" << scrollback_spill_minutes << std::endl;
+        config_file << "record_output=" << (record_output ? "true" : "false") << std::endl;
+        config_file << "record_dir=" << record_dir << std::endl;
+        config_file << "record_timestamps=" << (record_timestamps ? "true" : "false") << std::endl;
+        config_file << "record_plain_text=" << (record_plain_text ? "true" : "false") << std::endl;
+        config_file << "record_asciicast=" << (record_asciicast ? "true" : "false") << std::endl;
+        config_file << "latency_probe=" << (latency_probe ? "true" : "false") << std::endl;
+        config_file << "process_monitor_seconds=" << process_monitor_seconds << std::endl;
+        config_file << "render_path=" << render_path << std::endl;
+        
+        if (!keybindings.empty()) {
+            config_file << std::endl << "[Keybindings]" << std::endl;
+            for (const auto &binding : keybindings) {
+                config_file << binding.first << "=" << binding.second << std::endl;
+            }
+        }
+        
+        return config_file.str();
+    }
+    
+    // Serializacja pojedynczego motywu do formatu pliku .theme
+    static std::string serialize_theme(const ColorTheme& theme) {
         // Tworzymy kopię motywu, aby móc ją zmodyfikować przed zapisem
         ColorTheme theme_copy = theme;
         
         // Upewnij się, że kolory są poprawnie zainicjalizowane przed zapisem
         initialize_palette_if_empty(&theme_copy);
         
-        std::string theme_path = get_themes_dir() + "/" + theme_copy.name + ".theme";
-        std::ofstream theme_file(theme_path);
-        if (!theme_file.is_open()) {
-            std::cerr << "Cannot open theme file for writing: " << theme_path << std::endl;
-            return;
-        }
+        std::ostringstream theme_file;
         
         // Ustawienie precyzji dla liczb zmiennoprzecinkowych
         theme_file.precision(6);
@@ -205,63 +781,205 @@ struct TerminalConfig {
                       << theme_copy.palette[i].alpha << std::endl;
         }
         
-        theme_file.close();
-        std::cerr << "Motyw zapisany do " << theme_path << std::endl;
+        return theme_file.str();
     }
     
     // Wczytywanie konfiguracji z pliku
     void load_config() {
         // Wczytaj główny plik konfiguracyjny
-        std::ifstream config_file(get_config_path());
-        if (config_file.is_open()) {
-            std::string line;
-            std::string current_section;
-            
-            while (std::getline(config_file, line)) {
-                // Pomijanie pustych linii
-                if (line.empty()) continue;
-                
-                // Sprawdzanie, czy linia jest sekcją
-                if (line[0] == '[' && line[line.length() - 1] == ']') {
-                    current_section = line.substr(1, line.length() - 2);
-                    continue;
-                }
-                
-                // Przetwarzanie par klucz=wartość
-                size_t pos = line.find('=');
-                if (pos != std::string::npos) {
-                    std::string key = line.substr(0, pos);
-                    std::string value = line.substr(pos + 1);
-                    
-                    if (current_section == "General") {
-                        if (key == "font_family") {
-                            font_family = value;
-                        } else if (key == "font_size") {
-                            font_size = std::stod(value);
-                        } else if (key == "transparency") {
-                            transparency = std::stod(value);
-                        } else if (key == "current_theme") {
-                            current_theme_name = value;
-                        }
+        if (!load_settings()) {
+            std::cerr << "Cannot open configuration file for reading. Using default settings." << std::endl;
+        }
+        compile_keymap();
+        
+        // Przy starcie potrzebny jest tylko aktualny motyw, reszta wczytuje się w tle
+        load_themes_lazily();
+    }
+    
+    bool is_settings_dirty() const {
+        return settings_dirty;
+    }
+    
+    bool is_theme_dirty(const std::string &name) const {
+        return dirty_themes.count(name) > 0;
+    }
+    
+    void compile_keymap() {
+        for (const auto &error : keymap.compile(keybindings)) {
+            std::cerr << "[Keybindings] in " << get_config_path() << ": " << error << std::endl;
+        }
+    }
+    
+    // Wczytywanie ustawień z config.ini (bez motywów)
+    bool load_settings() {
+        IniParser ini;
+        if (!ini.load_file(get_config_path())) return false;
+        
+        IniParser::Entry entry;
+        while (ini.next(entry)) {
+            if (entry.section == "General") {
+                const std::string_view key = entry.key;
+                if (key == "font_family") {
+                    font_family = entry.value;
+                } else if (key == "font_size") {
+                    ini.to_double(entry, font_size);
+                } else if (key == "transparency") {
+                    ini.to_double(entry, transparency);
+                } else if (key == "current_theme") {
+                    current_theme_name = entry.value;
+                } else if (key == "scrollback_lines") {
+                    ini.to_int(entry, scrollback_lines);
+                } else if (key == "scrollback_budget_mb") {
+                    ini.to_int(entry, scrollback_budget_mb);
+                } else if (key == "background_tab_spawn") {
+                    background_tab_spawn = (entry.value == "true");
+                } else if (key == "scrollback_spill_minutes") {
+                    ini.to_int(entry, scrollback_spill_minutes);
+                } else if (key == "record_output") {
+                    record_output = (entry.value == "true");
+                } else if (key == "record_dir") {
+                    record_dir = entry.value;
+                } else if (key == "record_timestamps") {
+                    record_timestamps = (entry.value == "true");
+                } else if (key == "record_plain_text") {
+                    record_plain_text = (entry.value == "true");
+                } else if (key == "record_asciicast") {
+                    record_asciicast = (entry.value == "true");
+                } else if (key == "latency_probe") {
+                    latency_probe = (entry.value == "true");
+                } else if (key == "process_monitor_seconds") {
+                    ini.to_int(entry, process_monitor_seconds);
+                } else if (key == "render_path") {
+                    if (entry.value == "auto" || entry.value == "alpha") {
+                        render_path = entry.value;
+                    } else {
+                        ini.add_error(entry.line, "'render_path' must be auto or alpha");
                     }
                 }
+            } else if (entry.section == "Keybindings") {
+                keybindings[std::string(entry.key)] = entry.value;
             }
-            
-            config_file.close();
-        } else {
-            std::cerr << "Cannot open configuration file for reading. Using default settings." << std::endl;
         }
         
-        // Wczytaj wszystkie motywy z katalogu themes
-        load_themes();
+        // Błędne wartości zostają przy domyślnych, start nie jest przerywany
+        for (const auto &error : ini.errors()) {
+            std::cerr << error << std::endl;
+        }
+        return true;
+    }
+    
+    // Cache zawiera od razu wszystkie motywy. Bez niego parsujemy tylko aktualny
+    // motyw, a pozostałe pliki wczytuje wątek w tle. Gdy pliku aktualnego motywu
+    // nie ma, wczytujemy wszystko od razu (initialize_color_themes sprawdza, czy
+    // jakiekolwiek motywy istnieją).
+    void load_themes_lazily() {
+        std::string themes_dir = get_themes_dir();
+        
+        {
+            StartupProfiler::Scope profile("ThemeCache::load");
+            if (ThemeCache::load(themes_dir, color_themes)) {
+                return;
+            }
+        }
+        
+        ColorTheme theme;
+        std::string theme_path = themes_dir + "/" + current_theme_name + ".theme";
+        bool found;
+        {
+            StartupProfiler::Scope profile("load_theme " + current_theme_name + ".theme");
+            found = access(theme_path.c_str(), R_OK) == 0 &&
+                    parse_theme_file(theme_path, transparency, theme) &&
+                    theme.name == current_theme_name;
+        }
+        
+        if (!found) {
+            load_themes();
+            return;
+        }
+        
+        color_themes[theme.name] = theme;
+        load_remaining_themes_async();
     }
     
     // Wczytywanie wszystkich motywów z katalogu themes
     void load_themes() {
-        DIR *dir;
-        struct dirent *ent;
         std::string themes_dir = get_themes_dir();
         
+        // Szybka ścieżka: aktualny cache binarny zastępuje parsowanie plików tekstowych
+        {
+            StartupProfiler::Scope profile("ThemeCache::load");
+            if (ThemeCache::load(themes_dir, color_themes)) {
+                return;
+            }
+        }
+        
+        std::vector<ThemeCache::Entry> cache_entries;
+        int64_t dir_mtime;
+        bool cacheable = read_theme_directory(themes_dir, transparency, true, cache_entries, dir_mtime);
+        
+        for (const auto &entry : cache_entries) {
+            if (!entry.theme.name.empty()) {
+                color_themes[entry.theme.name] = entry.theme;
+                std::cerr << "Wczytano motyw: " << entry.theme.name << std::endl;
+            }
+        }
+        
+        if (cacheable) {
+            ThemeCache::store(dir_mtime, cache_entries);
+        }
+    }
+    
+    // Uruchamia wątek parsujący wszystkie pliki motywów. Wątek nie dotyka
+    // color_themes - wyniki są scalane w pętli GTK (albo w ensure_all_themes_loaded).
+    void load_remaining_themes_async() {
+        themes_complete = false;
+        std::string themes_dir = get_themes_dir();
+        double global_transparency = transparency;
+        
+        theme_loader = std::thread([this, themes_dir, global_transparency]() {
+            std::vector<ThemeCache::Entry> entries;
+            int64_t dir_mtime;
+            if (read_theme_directory(themes_dir, global_transparency, false, entries, dir_mtime)) {
+                ThemeCache::store(dir_mtime, entries);
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(theme_loader_mutex);
+                loaded_entries = std::move(entries);
+            }
+            g_idle_add(on_remaining_themes_loaded, this);
+        });
+    }
+    
+    // Czeka na wątek w tle (np. przed otwarciem okna wyboru motywu)
+    void ensure_all_themes_loaded() {
+        if (themes_complete) return;
+        
+        if (theme_loader.joinable()) {
+            theme_loader.join();
+        }
+        
+        std::lock_guard<std::mutex> lock(theme_loader_mutex);
+        for (const auto &entry : loaded_entries) {
+            // Motywy już obecne w pamięci (aktualny, zmodyfikowane) mają pierwszeństwo
+            if (!entry.theme.name.empty()) {
+                color_themes.emplace(entry.theme.name, entry.theme);
+            }
+        }
+        loaded_entries.clear();
+        themes_complete = true;
+    }
+    
+    // Parsuje wszystkie pliki .theme z katalogu bez modyfikowania stanu obiektu.
+    // Zwraca false, jeśli wyniku nie da się zapisać w cache.
+    static bool read_theme_directory(const std::string &themes_dir, double global_transparency, bool profile,
+                                     std::vector<ThemeCache::Entry> &entries, int64_t &dir_mtime) {
+        // Czas katalogu pobieramy przed odczytem, żeby zmiana w trakcie unieważniła cache
+        int64_t dir_size;
+        bool cacheable = ThemeCache::stat_file(themes_dir, dir_mtime, dir_size);
+        
+        DIR *dir;
+        struct dirent *ent;
         if ((dir = opendir(themes_dir.c_str())) != NULL) {
             while ((ent = readdir(dir)) != NULL) {
                 std::string filename = ent->d_name;
@@ -269,146 +987,2091 @@ struct TerminalConfig {
                 // Sprawdź, czy plik ma rozszerzenie .theme
                 if (filename.length() > 6 && filename.substr(filename.length() - 6) == ".theme") {
                     std::string theme_path = themes_dir + "/" + filename;
-                    load_theme(theme_path);
+                    gint64 start = g_get_monotonic_time();
+                    
+                    ThemeCache::Entry entry;
+                    entry.filename = filename;
+                    if (!ThemeCache::stat_file(theme_path, entry.mtime_ns, entry.size) ||
+                        !parse_theme_file(theme_path, global_transparency, entry.theme)) {
+                        cacheable = false;
+                        continue;
+                    }
+                    entries.push_back(entry);
+                    
+                    if (profile) {
+                        StartupProfiler::record("load_theme " + filename, start, g_get_monotonic_time());
+                    }
                 }
             }
             closedir(dir);
         } else {
             std::cerr << "Cannot open themes directory: " << themes_dir << std::endl;
+            cacheable = false;
         }
+        
+        return cacheable;
     }
     
-    // Wczytywanie pojedynczego motywu z pliku
-    void load_theme(const std::string& theme_path) {
-        std::ifstream theme_file(theme_path);
-        if (!theme_file.is_open()) {
-            std::cerr << "Cannot open theme file: " << theme_path << std::endl;
+    // Odbudowa cache na podstawie motywów w pamięci, po zapisaniu ich do plików.
+    // Pliki, których nie zapisaliśmy (inna nazwa niż motyw), unieważniają cache.
+    static void refresh_theme_cache(const std::map<std::string, ColorTheme> &color_themes) {
+        std::string themes_dir = get_themes_dir();
+        int64_t dir_mtime, dir_size;
+        DIR *dir = opendir(themes_dir.c_str());
+        if (dir == NULL || !ThemeCache::stat_file(themes_dir, dir_mtime, dir_size)) {
+            if (dir) closedir(dir);
+            ThemeCache::invalidate();
             return;
         }
         
-        std::string line;
-        std::string current_section;
-        ColorTheme theme;
+        std::vector<ThemeCache::Entry> cache_entries;
+        bool complete = true;
+        struct dirent *ent;
+        while (complete && (ent = readdir(dir)) != NULL) {
+            std::string filename = ent->d_name;
+            if (filename.length() <= 6 || filename.substr(filename.length() - 6) != ".theme") continue;
+            
+            auto it = color_themes.find(filename.substr(0, filename.length() - 6));
+            ThemeCache::Entry entry;
+            entry.filename = filename;
+            complete = it != color_themes.end() &&
+                       ThemeCache::stat_file(themes_dir + "/" + filename, entry.mtime_ns, entry.size);
+            if (complete) {
+                // Plik zawiera motyw po uzupełnieniu pustej palety w save_theme
+                entry.theme = it->second;
+                initialize_palette_if_empty(&entry.theme);
+                cache_entries.push_back(entry);
+            }
+        }
+        closedir(dir);
+        
+        if (complete) {
+            ThemeCache::store(dir_mtime, cache_entries);
+        } else {
+            ThemeCache::invalidate();
+        }
+    }
+    
+    // Wczytywanie pojedynczego motywu z pliku
+    bool load_theme(const std::string& theme_path) {
+        ColorTheme theme;
+        if (!parse_theme_file(theme_path, transparency, theme)) {
+            return false;
+        }
+        
+        // Dodaj motyw do mapy, jeśli ma nazwę
+        if (!theme.name.empty()) {
+            color_themes[theme.name] = theme;
+            std::cerr << "Wczytano motyw: " << theme.name << std::endl;
+        }
+        return true;
+    }
+    
+    // Parsowanie pliku motywu; nie modyfikuje konfiguracji, więc można go używać z wątku w tle
+    static bool parse_theme_file(const std::string& theme_path, double global_transparency, ColorTheme &parsed) {
+        IniParser ini;
+        if (!ini.load_file(theme_path)) {
+            std::cerr << "Cannot open theme file: " << theme_path << std::endl;
+            return false;
+        }
+        
+        ColorTheme theme = {};
+        IniParser::Entry entry;
+        while (ini.next(entry)) {
+            if (entry.section == "Theme") {
+                if (entry.key == "name") {
+                    theme.name = entry.value;
+                } else if (entry.key == "foreground") {
+                    parse_color(ini, entry, theme.foreground);
+                } else if (entry.key == "background") {
+                    parse_color(ini, entry, theme.background);
+                } else if (entry.key == "transparency") {
+                    // Nie wczytujemy przezroczystości motywu, używamy globalnej przezroczystości
+                    theme.transparency = global_transparency;
+                }
+            } else if (entry.section == "Palette") {
+                // Sprawdź, czy klucz ma format "colorN"
+                int index;
+                if (IniParser::key_suffix(entry.key, "color", index) && index >= 0 && index < 16) {
+                    parse_color(ini, entry, theme.palette[index]);
+                }
+            }
+        }
+        
+        // Uszkodzony kolor zostaje domyślny, reszta motywu jest używana
+        for (const auto &error : ini.errors()) {
+            std::cerr << error << std::endl;
+        }
+        
+        parsed = theme;
+        return true;
+    }
+    
+private:
+    // Zrzut zmienionych plików przekazywany do wątku zapisu
+    struct SaveJob {
+        std::vector<std::pair<std::string, std::string>> files;
+        bool refresh_cache = false;
+        std::map<std::string, ColorTheme> themes;
+    };
+    
+    // Zmiany z krótkiego okna czasu (np. przytrzymany Ctrl+=) są zapisywane razem
+    static constexpr guint SAVE_DEBOUNCE_MS = 500;
+    
+    std::thread theme_loader;
+    std::mutex theme_loader_mutex;
+    std::vector<ThemeCache::Entry> loaded_entries;
+    
+    bool settings_dirty = false;
+    std::set<std::string> dirty_themes;
+    guint save_timeout_id = 0;
+    std::thread save_worker;
+    std::mutex save_mutex;
+    std::condition_variable save_cv;
+    std::deque<SaveJob> save_queue;
+    bool save_worker_busy = false;
+    bool save_worker_stop = false;
+    bool theme_cache_stale = false;  // motyw zapisany przed wczytaniem pozostałych motywów
+    
+    void queue_save_job(SaveJob &&job) {
+        {
+            std::lock_guard<std::mutex> lock(save_mutex);
+            save_queue.push_back(std::move(job));
+            if (!save_worker.joinable()) {
+                save_worker = std::thread(&TerminalConfig::save_worker_loop, this);
+            }
+        }
+        save_cv.notify_all();
+    }
+    
+    void schedule_save() {
+        if (save_timeout_id != 0) {
+            g_source_remove(save_timeout_id);
+        }
+        save_timeout_id = g_timeout_add(SAVE_DEBOUNCE_MS, on_save_timeout, this);
+    }
+    
+    static gboolean on_save_timeout(gpointer data) {
+        TerminalConfig *self = static_cast<TerminalConfig*>(data);
+        self->save_timeout_id = 0;
+        self->save_config();
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Wątek zapisu: operacje na dysku nigdy nie blokują wątku GTK
+    void save_worker_loop() {
+        std::unique_lock<std::mutex> lock(save_mutex);
+        while (true) {
+            save_cv.wait(lock, [this]() { return save_worker_stop || !save_queue.empty(); });
+            if (save_queue.empty()) {
+                return;
+            }
+            
+            SaveJob job = std::move(save_queue.front());
+            save_queue.pop_front();
+            save_worker_busy = true;
+            lock.unlock();
+            
+            for (const auto &file : job.files) {
+                if (!write_file_atomically(file.first, file.second)) {
+                    std::cerr << "Cannot write configuration file: " << file.first << std::endl;
+                }
+            }
+            if (job.refresh_cache) {
+                refresh_theme_cache(job.themes);
+            }
+            
+            lock.lock();
+            save_worker_busy = false;
+            save_cv.notify_all();
+        }
+    }
+    
+    static gboolean on_remaining_themes_loaded(gpointer data) {
+        TerminalConfig *self = static_cast<TerminalConfig*>(data);
+        self->ensure_all_themes_loaded();
+        
+        // Kolejka zachowuje porządek: cache powstaje po zapisie zmienionych motywów
+        if (self->theme_cache_stale) {
+            self->theme_cache_stale = false;
+            SaveJob job;
+            job.refresh_cache = true;
+            job.themes = self->color_themes;
+            self->queue_save_job(std::move(job));
+        }
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Parsowanie koloru z formatu "r,g,b,a" (alfa jest opcjonalna)
+    static void parse_color(IniParser &ini, const IniParser::Entry &entry, GdkRGBA& color) {
+        double components[4] = {color.red, color.green, color.blue, color.alpha};
+        if (ini.to_double_list(entry, components, 3, 4)) {
+            color.red = components[0];
+            color.green = components[1];
+            color.blue = components[2];
+            color.alpha = components[3];
+        }
+    }
+};
+
+// Scrollback of tabs nobody looked at for a while is written out as gzip under
+// $XDG_CACHE_HOME/lum-terminal/scrollback and trimmed from memory. File names
+// start with the owning process id, so files left by a crashed process can be
+// told apart from the ones still in use.
+class ScrollbackSpill {
+public:
+    static std::string get_spill_dir() {
+        return std::string(g_get_user_cache_dir()) + "/lum-terminal/scrollback";
+    }
+    
+    // Returns a fresh file path; the first call also removes stale files
+    static std::string new_spill_path() {
+        static int counter = 0;
+        std::string dir = get_spill_dir();
+        if (counter == 0) {
+            g_mkdir_with_parents(dir.c_str(), 0700);
+            remove_stale_files(dir);
+        }
+        return dir + "/" + std::to_string(getpid()) + "-" + std::to_string(++counter) + ".txt.gz";
+    }
+    
+    // Writes the whole terminal contents (scrollback and screen) as gzip
+    static bool write(VteTerminal *terminal, const std::string &path) {
+        GError *error = NULL;
+        GFile *file = g_file_new_for_path(path.c_str());
+        GFileOutputStream *file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, &error);
+        g_object_unref(file);
+        if (file_stream == NULL) {
+            std::cerr << "Cannot write scrollback to " << path << ": " << error->message << std::endl;
+            g_error_free(error);
+            return false;
+        }
+        
+        GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+        GOutputStream *stream = g_converter_output_stream_new(G_OUTPUT_STREAM(file_stream), G_CONVERTER(compressor));
+        g_object_unref(compressor);
+        g_object_unref(file_stream);
+        
+        bool ok = vte_terminal_write_contents_sync(terminal, stream, VTE_WRITE_DEFAULT, NULL, &error) &&
+                  g_output_stream_close(stream, NULL, &error);
+        g_object_unref(stream);
+        
+        if (!ok) {
+            std::cerr << "Cannot write scrollback to " << path << ": " << error->message << std::endl;
+            g_error_free(error);
+            unlink(path.c_str());
+        }
+        return ok;
+    }
+    
+    static bool read(const std::string &path, std::string &contents) {
+        GFile *file = g_file_new_for_path(path.c_str());
+        GFileInputStream *file_stream = g_file_read(file, NULL, NULL);
+        g_object_unref(file);
+        if (file_stream == NULL) {
+            return false;
+        }
+        
+        GZlibDecompressor *decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+        GInputStream *stream = g_converter_input_stream_new(G_INPUT_STREAM(file_stream), G_CONVERTER(decompressor));
+        g_object_unref(decompressor);
+        g_object_unref(file_stream);
+        
+        char buffer[65536];
+        gssize bytes_read;
+        while ((bytes_read = g_input_stream_read(stream, buffer, sizeof(buffer), NULL, NULL)) > 0) {
+            contents.append(buffer, bytes_read);
+        }
+        g_object_unref(stream);
+        return bytes_read == 0;
+    }
+
+private:
+    static void remove_stale_files(const std::string &dir) {
+        DIR *d = opendir(dir.c_str());
+        if (d == NULL) return;
+        
+        struct dirent *ent;
+        while ((ent = readdir(d)) != NULL) {
+            pid_t pid = atoi(ent->d_name);
+            if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH) {
+                unlink((dir + "/" + ent->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+};
+
+// Reading and writing of asciicast v2 files: a JSON header line followed by
+// one [time, type, data] array per line. Understood event types are "o"
+// (output), "i" (input, replayed into a shell) and "r" (resize, "COLSxROWS");
+// "m" markers are skipped and any other type is an error.
+class Asciicast {
+public:
+    struct Event {
+        double time;
+        char type;
+        std::string data;
+    };
+    
+    struct Recording {
+        glong columns = 80;
+        glong rows = 24;
+        std::vector<Event> events;
+    };
+    
+    static std::string format_header(glong columns, glong rows, gint64 timestamp) {
+        return "{\"version\": 2, \"width\": " + std::to_string(columns) + ", \"height\": " + std::to_string(rows) +
+               ", \"timestamp\": " + std::to_string(timestamp) + "}\n";
+    }
+    
+    static std::string format_event(double time, char type, const std::string &data) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "[%.6f, \"%c\", ", time, type);
+        return prefix + quote(data) + "]\n";
+    }
+    
+    // Length of the longest prefix that does not end inside a UTF-8 sequence
+    static size_t complete_utf8_prefix(const std::string &data) {
+        size_t size = data.size();
+        for (size_t back = 1; back <= 3 && back <= size; back++) {
+            unsigned char c = data[size - back];
+            if ((c & 0xc0) == 0x80) continue;  // bajt kontynuacji
+            size_t length = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+            return length > back ? size - back : size;
+        }
+        return size;
+    }
+    
+    static bool load(const std::string &path, Recording &recording, std::string &error) {
+        std::ifstream file(path);
+        std::string line;
+        glong version = 0;
+        if (!std::getline(file, line) || !header_number(line, "version", version) || version != 2) {
+            error = "not an asciicast v2 file";
+            return false;
+        }
+        header_number(line, "width", recording.columns);
+        header_number(line, "height", recording.rows);
+        
+        int line_number = 1;
+        while (std::getline(file, line)) {
+            line_number++;
+            if (line.empty()) continue;
+            
+            Event event;
+            const char *p = line.c_str();
+            char *end;
+            std::string type;
+            if (*p++ != '[' || (event.time = g_ascii_strtod(p, &end), end == p) ||
+                !skip_separator(p = end, ',') || !parse_string(p, type) || type.size() != 1 ||
+                !skip_separator(p, ',') || !parse_string(p, event.data) || !skip_separator(p, ']')) {
+                error = "invalid event on line " + std::to_string(line_number);
+                return false;
+            }
+            event.type = type[0];
+            if (event.type == 'm') continue;
+            if (event.type != 'o' && event.type != 'i' && event.type != 'r') {
+                error = "unsupported event type \"" + type + "\" on line " + std::to_string(line_number);
+                return false;
+            }
+            recording.events.push_back(std::move(event));
+        }
+        return true;
+    }
+
+private:
+    // Niepoprawne bajty UTF-8 są zastępowane znakiem U+FFFD, żeby plik był poprawnym JSON-em
+    static std::string quote(const std::string &data) {
+        std::string out = "\"";
+        const char *p = data.c_str();
+        const char *end = p + data.size();
+        while (p < end) {
+            const gchar *valid_end;
+            g_utf8_validate(p, end - p, &valid_end);
+            for (; p < valid_end; p++) {
+                unsigned char c = *p;
+                switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20 || c == 0x7f) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                    } else {
+                        out += (char)c;
+                    }
+                }
+            }
+            if (p < end) {
+                out += "\\ufffd";
+                p++;
+            }
+        }
+        return out + "\"";
+    }
+    
+    // Accepts both "key": 2 and the compact "key":2 written by other tools
+    static bool header_number(const std::string &header, const std::string &key, glong &value) {
+        size_t pos = header.find("\"" + key + "\":");
+        if (pos == std::string::npos) return false;
+        
+        const char *start = header.c_str() + pos + key.size() + 3;
+        char *end;
+        errno = 0;
+        long number = strtol(start, &end, 10);
+        if (end == start || errno != 0) return false;
+        value = number;
+        return true;
+    }
+    
+    static bool skip_separator(const char *&p, char separator) {
+        while (*p == ' ') p++;
+        if (*p != separator) return false;
+        p++;
+        while (*p == ' ') p++;
+        return true;
+    }
+    
+    static bool parse_string(const char *&p, std::string &out) {
+        if (*p++ != '"') return false;
+        while (*p && *p != '"') {
+            if (*p != '\\') {
+                out += *p++;
+                continue;
+            }
+            p++;
+            switch (*p++) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                gunichar c;
+                if (!parse_hex4(p, c)) return false;
+                // Para surogatów UTF-16 dla znaków spoza BMP
+                if (c >= 0xd800 && c <= 0xdbff && p[0] == '\\' && p[1] == 'u') {
+                    gunichar low;
+                    p += 2;
+                    if (!parse_hex4(p, low)) return false;
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                }
+                char utf8[6];
+                out.append(utf8, g_unichar_to_utf8(c, utf8));
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        if (*p != '"') return false;
+        p++;
+        return true;
+    }
+    
+    static bool parse_hex4(const char *&p, gunichar &value) {
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = g_ascii_xdigit_value(p[i]);
+            if (digit < 0) return false;
+            value = value * 16 + digit;
+        }
+        p += 4;
+        return true;
+    }
+};
+
+// Records the raw output of a tab. The GTK thread appends chunks to a
+// single-producer/single-consumer ring buffer without taking locks; a shared
+// writer thread drains all rings every WRITE_INTERVAL_MS and writes them out in
+// large batches. When the disk cannot keep up and the ring is full, output is
+// dropped (and reported) instead of blocking the terminal.
+// Files: <base>.log (raw bytes), <base>.timing (scriptreplay timing, optional),
+// <base>.txt (output with escape sequences removed, optional) and <base>.cast
+// (asciicast v2 with output and resize events, optional, see Asciicast).
+class OutputRecorder {
+public:
+    static constexpr size_t RING_SIZE = 4 * 1024 * 1024;
+    static constexpr int WRITE_INTERVAL_MS = 200;
+
+    // Files are created by the writer thread, so opening never touches the disk here
+    static OutputRecorder *open(const std::string &base_path, bool timestamps, bool plain_text,
+                                bool asciicast, glong columns, glong rows) {
+        OutputRecorder *recorder = new OutputRecorder(base_path, timestamps, plain_text, asciicast, columns, rows);
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(recorder);
+        if (!writer.joinable()) {
+            writer_stop = false;
+            writer = std::thread(writer_loop);
+        }
+        return recorder;
+    }
+    
+    // GTK thread only
+    void record(const char *data, size_t size) {
+        push_chunk(CHUNK_OUTPUT, data, size);
+    }
+    
+    // GTK thread only; kept only in the asciicast file
+    void record_resize(glong columns, glong rows) {
+        if (!asciicast) return;
+        std::string size = std::to_string(columns) + "x" + std::to_string(rows);
+        push_chunk(CHUNK_RESIZE, size.data(), size.size());
+    }
+    
+    void push_chunk(char type, const char *data, size_t size) {
+        size_t write_pos = head.load(std::memory_order_relaxed);
+        size_t read_pos = tail.load(std::memory_order_acquire);
+        if (sizeof(ChunkHeader) + size > RING_SIZE - (write_pos - read_pos)) {
+            dropped_bytes.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+        
+        ChunkHeader header = {g_get_monotonic_time(), (uint32_t)size, type};
+        copy_in(write_pos, reinterpret_cast<const char*>(&header), sizeof(header));
+        copy_in(write_pos + sizeof(header), data, size);
+        head.store(write_pos + sizeof(header) + size, std::memory_order_release);
+    }
+    
+    // The writer thread flushes what is left and deletes the recorder
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+    
+    // Writes out all recorders and stops the writer thread (at process exit)
+    static void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            writer_stop = true;
+        }
+        writer_cv.notify_all();
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+    
+    static std::string get_default_dir() {
+        return std::string(g_get_user_data_dir()) + "/lum-terminal/recordings";
+    }
+    
+    // <katalog>/<data>-<pid>-<numer>, wspólna nazwa plików jednej zakładki
+    static std::string new_base_path(const std::string &dir) {
+        static int counter = 0;
+        GDateTime *now = g_date_time_new_now_local();
+        gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+        std::string path = dir + "/" + stamp + "-" + std::to_string(getpid()) + "-" + std::to_string(++counter);
+        g_free(stamp);
+        g_date_time_unref(now);
+        return path;
+    }
+
+private:
+    static constexpr char CHUNK_OUTPUT = 'o';
+    static constexpr char CHUNK_RESIZE = 'r';
+    
+    struct ChunkHeader {
+        gint64 time_us;
+        uint32_t size;
+        char type;
+    };
+    
+    enum class StripState { Text, Escape, Charset, Csi, String, StringEscape };
+    
+    std::string base_path;
+    bool timestamps;
+    bool plain_text;
+    bool asciicast;
+    glong initial_columns;
+    glong initial_rows;
+    gint64 start_time_us;
+    std::unique_ptr<char[]> ring;
+    std::atomic<size_t> head{0};  // zapisywane tylko przez wątek GTK
+    std::atomic<size_t> tail{0};  // zapisywane tylko przez wątek zapisu
+    std::atomic<bool> closed{false};
+    std::atomic<uint64_t> dropped_bytes{0};
+    
+    // Stan wątku zapisu
+    int log_fd = -1;
+    int timing_fd = -1;
+    int text_fd = -1;
+    int cast_fd = -1;
+    std::string pending_utf8;  // niepełny znak UTF-8 z końca poprzedniej porcji
+    bool files_failed = false;
+    gint64 last_chunk_time = 0;
+    uint64_t reported_dropped = 0;
+    StripState strip_state = StripState::Text;
+    
+    static inline std::mutex registry_mutex;
+    static inline std::condition_variable writer_cv;
+    static inline std::vector<OutputRecorder*> registry;
+    static inline std::thread writer;
+    static inline bool writer_stop = false;
+    
+    OutputRecorder(const std::string &base_path, bool timestamps, bool plain_text,
+                   bool asciicast, glong columns, glong rows)
+        : base_path(base_path), timestamps(timestamps), plain_text(plain_text), asciicast(asciicast),
+          initial_columns(columns), initial_rows(rows), start_time_us(g_get_monotonic_time()),
+          ring(new char[RING_SIZE]) {}
+    
+    ~OutputRecorder() {
+        if (log_fd >= 0) ::close(log_fd);
+        if (timing_fd >= 0) ::close(timing_fd);
+        if (text_fd >= 0) ::close(text_fd);
+        if (cast_fd >= 0) ::close(cast_fd);
+    }
+    
+    void copy_in(size_t position, const char *data, size_t size) {
+        size_t offset = position % RING_SIZE;
+        size_t first = std::min(size, RING_SIZE - offset);
+        memcpy(ring.get() + offset, data, first);
+        memcpy(ring.get(), data + first, size - first);
+    }
+    
+    void copy_out(size_t position, char *data, size_t size) const {
+        size_t offset = position % RING_SIZE;
+        size_t first = std::min(size, RING_SIZE - offset);
+        memcpy(data, ring.get() + offset, first);
+        memcpy(data + first, ring.get(), size - first);
+    }
+    
+    // Blokada chroni tylko listę rejestratorów - zapis na dysk odbywa się bez niej,
+    // więc open() w wątku GTK nigdy nie czeka na wolny dysk
+    static void writer_loop() {
+        while (true) {
+            std::vector<OutputRecorder*> recorders;
+            bool stopping;
+            {
+                std::unique_lock<std::mutex> lock(registry_mutex);
+                writer_cv.wait_for(lock, std::chrono::milliseconds(WRITE_INTERVAL_MS), []() { return writer_stop; });
+                stopping = writer_stop;
+                recorders = registry;
+            }
+            
+            std::vector<OutputRecorder*> finished;
+            for (auto recorder : recorders) {
+                // Flaga jest czytana przed opróżnieniem, żeby nie zgubić ostatnich danych
+                bool done = recorder->closed.load(std::memory_order_acquire) || stopping;
+                recorder->drain();
+                if (done) {
+                    finished.push_back(recorder);
+                }
+            }
+            
+            if (!finished.empty()) {
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                for (auto recorder : finished) {
+                    registry.erase(std::find(registry.begin(), registry.end(), recorder));
+                }
+            }
+            for (auto recorder : finished) {
+                delete recorder;
+            }
+            
+            if (stopping) {
+                return;
+            }
+        }
+    }
+    
+    void drain() {
+        size_t read_pos = tail.load(std::memory_order_relaxed);
+        size_t write_pos = head.load(std::memory_order_acquire);
+        if (read_pos == write_pos) {
+            report_dropped();
+            return;
+        }
+        
+        std::string raw, timing, text, cast;
+        raw.reserve(write_pos - read_pos);
+        while (read_pos < write_pos) {
+            ChunkHeader header;
+            copy_out(read_pos, reinterpret_cast<char*>(&header), sizeof(header));
+            std::string chunk(header.size, '\0');
+            copy_out(read_pos + sizeof(header), &chunk[0], header.size);
+            read_pos += sizeof(header) + header.size;
+            
+            if (asciicast) {
+                double time = (header.time_us - start_time_us) / (double)G_USEC_PER_SEC;
+                if (header.type == CHUNK_OUTPUT) {
+                    // Znak UTF-8 przecięty na granicy porcji trafia do następnego zdarzenia
+                    pending_utf8 += chunk;
+                    size_t complete = Asciicast::complete_utf8_prefix(pending_utf8);
+                    if (complete > 0) {
+                        cast += Asciicast::format_event(time, 'o', pending_utf8.substr(0, complete));
+                        pending_utf8.erase(0, complete);
+                    }
+                } else {
+                    cast += Asciicast::format_event(time, 'r', chunk);
+                }
+            }
+            if (header.type != CHUNK_OUTPUT) {
+                continue;
+            }
+            raw += chunk;
+            
+            if (timestamps) {
+                double delay = last_chunk_time ? (header.time_us - last_chunk_time) / (double)G_USEC_PER_SEC : 0.0;
+                char line[64];
+                snprintf(line, sizeof(line), "%.6f %u\n", delay, header.size);
+                timing += line;
+            }
+            last_chunk_time = header.time_us;
+        }
+        tail.store(read_pos, std::memory_order_release);
+        
+        if (plain_text) {
+            strip_escapes(raw, text);
+        }
+        
+        if (!open_files()) return;
+        write_fully(log_fd, raw);
+        write_fully(timing_fd, timing);
+        write_fully(text_fd, text);
+        write_fully(cast_fd, cast);
+        report_dropped();
+    }
+    
+    bool open_files() {
+        if (log_fd >= 0 || files_failed) {
+            return !files_failed;
+        }
+        
+        gchar *dir = g_path_get_dirname(base_path.c_str());
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+        
+        int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+        log_fd = ::open((base_path + ".log").c_str(), flags, 0600);
+        if (timestamps) timing_fd = ::open((base_path + ".timing").c_str(), flags, 0600);
+        if (plain_text) text_fd = ::open((base_path + ".txt").c_str(), flags, 0600);
+        if (asciicast) {
+            cast_fd = ::open((base_path + ".cast").c_str(), flags, 0600);
+            write_fully(cast_fd, Asciicast::format_header(initial_columns, initial_rows, g_get_real_time() / G_USEC_PER_SEC));
+        }
+        
+        if (log_fd < 0) {
+            std::cerr << "Cannot open recording " << base_path << ".log: " << strerror(errno) << std::endl;
+            files_failed = true;
+        }
+        return !files_failed;
+    }
+    
+    static void write_fully(int fd, const std::string &data) {
+        const char *p = data.data();
+        size_t remaining = data.size();
+        while (fd >= 0 && remaining > 0) {
+            ssize_t written = write(fd, p, remaining);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Cannot write recording: " << strerror(errno) << std::endl;
+                return;
+            }
+            p += written;
+            remaining -= written;
+        }
+    }
+    
+    void report_dropped() {
+        uint64_t dropped = dropped_bytes.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped) {
+            std::cerr << "Recording " << base_path << ": " << dropped - reported_dropped
+                      << " bytes dropped, disk too slow" << std::endl;
+            reported_dropped = dropped;
+        }
+    }
+    
+    // Usuwa sekwencje sterujące (CSI, OSC/DCS, zmiany zestawu znaków) i znaki
+    // kontrolne poza \n i \t; stan przechodzi między porcjami danych
+    void strip_escapes(const std::string &raw, std::string &text) {
+        text.reserve(raw.size());
+        for (unsigned char c : raw) {
+            switch (strip_state) {
+            case StripState::Text:
+                if (c == 0x1b) {
+                    strip_state = StripState::Escape;
+                } else if (c >= 0x20 || c == '\n' || c == '\t') {
+                    if (c != 0x7f) text += (char)c;
+                }
+                break;
+            case StripState::Escape:
+                if (c == '[') {
+                    strip_state = StripState::Csi;
+                } else if (c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X') {
+                    strip_state = StripState::String;
+                } else if (c == '(' || c == ')' || c == '*' || c == '+' || c == '#' || c == '%') {
+                    strip_state = StripState::Charset;
+                } else {
+                    strip_state = StripState::Text;
+                }
+                break;
+            case StripState::Charset:
+                strip_state = StripState::Text;
+                break;
+            case StripState::Csi:
+                if (c >= 0x40 && c <= 0x7e) strip_state = StripState::Text;
+                break;
+            case StripState::String:
+                if (c == 0x07) strip_state = StripState::Text;
+                else if (c == 0x1b) strip_state = StripState::StringEscape;
+                break;
+            case StripState::StringEscape:
+                strip_state = (c == '\\') ? StripState::Text : StripState::String;
+                break;
+            }
+        }
+    }
+};
+
+// Per-tab CPU and memory use, sampled by a background thread every
+// process_monitor_seconds. Each pass reads /proc/<pid>/stat of all processes to
+// link children to parents, then statm only for processes under a tab's shell.
+// The GTK thread only hands over the list of shells and copies the results, so
+// a slow /proc never delays drawing.
+class ProcessMonitor {
+public:
+    struct Usage {
+        double cpu_percent = 0;
+        guint64 rss_bytes = 0;
+        int processes = 0;
+    };
+    
+    // Starts the sampler or changes its interval
+    static void start(guint interval_s) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (interval != interval_s) {
+            interval = interval_s;
+            interval_changed = true;
+        }
+        if (!sampler.joinable()) {
+            stop_requested = false;
+            sampler = std::thread(sampler_loop);
+        }
+        wake.notify_all();
+    }
+    
+    static void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop_requested = true;
+        }
+        wake.notify_all();
+        if (sampler.joinable()) {
+            sampler.join();
+        }
+        results.clear();
+    }
+    
+    // Powłoki zakładek, których drzewa procesów są liczone w następnym przebiegu
+    static void set_roots(const std::vector<GPid> &pids) {
+        std::lock_guard<std::mutex> lock(mutex);
+        roots = pids;
+    }
+    
+    static std::map<GPid, Usage> get_usage() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return results;
+    }
+
+private:
+    struct ProcessTimes {
+        unsigned long long start_time;  // odróżnia ponownie użyty pid
+        unsigned long long cpu_ticks;
+    };
+    
+    static inline std::mutex mutex;
+    static inline std::condition_variable wake;
+    static inline std::thread sampler;
+    static inline bool stop_requested = false;
+    static inline guint interval = 0;
+    static inline bool interval_changed = false;  // przerywa czekanie według starego interwału
+    static inline std::vector<GPid> roots;
+    static inline std::map<GPid, Usage> results;
+    
+    static void sampler_loop() {
+        // Stan poprzedniego przebiegu, używany tylko przez wątek próbkujący
+        std::map<pid_t, ProcessTimes> previous;
+        gint64 previous_time = 0;
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop_requested) {
+            std::vector<GPid> current_roots = roots;
+            lock.unlock();
+            
+            std::map<pid_t, ProcessTimes> times;
+            gint64 now = g_get_monotonic_time();
+            std::map<GPid, Usage> usage = sample(current_roots, previous, times,
+                                                  previous_time ? (now - previous_time) / (double)G_USEC_PER_SEC : 0);
+            previous.swap(times);
+            previous_time = now;
+            
+            lock.lock();
+            results.swap(usage);
+            
+            // Nowy interwał liczy się od ostatniego przebiegu; jeśli już minął, próbkowanie rusza od razu
+            auto sampled = std::chrono::steady_clock::now();
+            do {
+                interval_changed = false;
+                wake.wait_until(lock, sampled + std::chrono::seconds(interval),
+                                [] { return stop_requested || interval_changed; });
+            } while (interval_changed && !stop_requested);
+        }
+    }
+    
+    static std::map<GPid, Usage> sample(const std::vector<GPid> &roots, const std::map<pid_t, ProcessTimes> &previous,
+                                        std::map<pid_t, ProcessTimes> &times, double elapsed_s) {
+        std::map<GPid, Usage> usage;
+        if (roots.empty()) return usage;
+        
+        std::map<pid_t, std::vector<pid_t>> children;
+        DIR *proc = opendir("/proc");
+        if (!proc) return usage;
+        while (struct dirent *entry = readdir(proc)) {
+            char *end;
+            long pid = strtol(entry->d_name, &end, 10);
+            if (*end != '\0' || pid <= 0) continue;
+            
+            pid_t parent;
+            ProcessTimes process;
+            if (read_stat(pid, parent, process)) {
+                children[parent].push_back(pid);
+                times[pid] = process;
+            }
+        }
+        closedir(proc);
+        
+        static const long ticks_per_second = sysconf(_SC_CLK_TCK);
+        static const long page_size = sysconf(_SC_PAGESIZE);
+        for (GPid root : roots) {
+            if (times.find(root) == times.end()) continue;
+            
+            Usage &tab = usage[root];
+            unsigned long long ticks = 0;
+            std::vector<pid_t> queue = {root};
+            while (!queue.empty()) {
+                pid_t pid = queue.back();
+                queue.pop_back();
+                
+                const ProcessTimes &process = times[pid];
+                auto before = previous.find(pid);
+                if (before != previous.end() && before->second.start_time == process.start_time) {
+                    ticks += process.cpu_ticks - before->second.cpu_ticks;
+                } else {
+                    ticks += process.cpu_ticks;  // proces powstał po poprzednim przebiegu
+                }
+                tab.rss_bytes += read_resident_pages(pid) * page_size;
+                tab.processes++;
+                
+                auto found = children.find(pid);
+                if (found != children.end()) {
+                    queue.insert(queue.end(), found->second.begin(), found->second.end());
+                }
+            }
+            if (elapsed_s > 0) {
+                tab.cpu_percent = ticks * 100.0 / ticks_per_second / elapsed_s;
+            }
+        }
+        return usage;
+    }
+    
+    static bool read_small_file(const std::string &path, char *buffer, size_t size) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        ssize_t length = read(fd, buffer, size - 1);
+        ::close(fd);
+        if (length <= 0) return false;
+        buffer[length] = '\0';
+        return true;
+    }
+    
+    // Pola po nazwie polecenia, które może zawierać spacje i nawiasy
+    static bool read_stat(pid_t pid, pid_t &parent, ProcessTimes &process) {
+        char buffer[1024];
+        if (!read_small_file("/proc/" + std::to_string(pid) + "/stat", buffer, sizeof(buffer))) return false;
+        
+        const char *fields = strrchr(buffer, ')');
+        if (!fields) return false;
+        
+        unsigned long long user_ticks, system_ticks;
+        int parsed = sscanf(fields + 2, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+                            &parent, &user_ticks, &system_ticks, &process.start_time);
+        if (parsed != 4) return false;
+        process.cpu_ticks = user_ticks + system_ticks;
+        return true;
+    }
+    
+    static unsigned long long read_resident_pages(pid_t pid) {
+        char buffer[256];
+        unsigned long long total, resident;
+        if (!read_small_file("/proc/" + std::to_string(pid) + "/statm", buffer, sizeof(buffer)) ||
+            sscanf(buffer, "%llu %llu", &total, &resident) != 2) {
+            return 0;
+        }
+        return resident;
+    }
+};
+
+// Keypress-to-photon latency of one tab, collected when latency_probe=true.
+// A key is stamped in the window's key handler and again right before VTE
+// handles it; the first output change after that marks the echo, and the next
+// painted frame of the window completes the sample. Keys that produce no
+// output are dropped after a second. Only the last MAX_SAMPLES are kept, so
+// the percentiles follow the current font, theme and transparency.
+class LatencyProbe {
+public:
+    static constexpr size_t MAX_SAMPLES = 1000;
+    static constexpr gint64 PENDING_TIMEOUT_US = G_USEC_PER_SEC;
+    
+    struct Summary {
+        size_t samples = 0;
+        double p50 = 0, p95 = 0, p99 = 0;  // klawisz -> narysowana klatka, ms
+        double dispatch_p50 = 0;           // klawisz -> obsługa w VTE, ms
+        double echo_p50 = 0;               // klawisz -> zmiana zawartości terminala, ms
+    };
+    
+    void key_pressed(gint64 time) {
+        expire(time);
+        // Poprzedni klawisz nie dotarł do terminala (np. trafił do pola wyszukiwania)
+        if (!pending.empty() && pending.back().dispatched == 0) {
+            pending.pop_back();
+        }
+        pending.push_back({time, 0, 0});
+    }
+    
+    void key_dispatched(gint64 time) {
+        if (!pending.empty() && pending.back().dispatched == 0) {
+            pending.back().dispatched = time;
+        }
+    }
+    
+    // Jedna zmiana zawartości odpowiada najstarszemu klawiszowi, który czeka na echo
+    void output_changed(gint64 time) {
+        for (auto &key : pending) {
+            if (key.dispatched != 0 && key.echoed == 0) {
+                key.echoed = time;
+                return;
+            }
+        }
+    }
+    
+    void frame_painted(gint64 time) {
+        while (!pending.empty() && pending.front().echoed != 0) {
+            const PendingKey &key = pending.front();
+            add(total, time - key.pressed);
+            add(dispatch, key.dispatched - key.pressed);
+            add(echo, key.echoed - key.pressed);
+            pending.pop_front();
+        }
+        expire(time);
+    }
+    
+    bool has_pending() const {
+        return !pending.empty();
+    }
+    
+    Summary summary() const {
+        Summary result;
+        result.samples = total.size();
+        if (total.empty()) return result;
+        
+        result.p50 = percentile(total, 50);
+        result.p95 = percentile(total, 95);
+        result.p99 = percentile(total, 99);
+        result.dispatch_p50 = percentile(dispatch, 50);
+        result.echo_p50 = percentile(echo, 50);
+        return result;
+    }
+
+private:
+    struct PendingKey {
+        gint64 pressed;
+        gint64 dispatched;
+        gint64 echoed;
+    };
+    std::deque<PendingKey> pending;
+    std::deque<gint64> total;
+    std::deque<gint64> dispatch;
+    std::deque<gint64> echo;
+    
+    static void add(std::deque<gint64> &samples, gint64 value) {
+        samples.push_back(value);
+        if (samples.size() > MAX_SAMPLES) {
+            samples.pop_front();
+        }
+    }
+    
+    // Klawisze bez echa (np. strzałki przy pustym wierszu) nie mogą zablokować kolejki
+    void expire(gint64 now) {
+        while (!pending.empty() && now - pending.front().pressed > PENDING_TIMEOUT_US) {
+            pending.pop_front();
+        }
+    }
+    
+    static double percentile(const std::deque<gint64> &samples, int percent) {
+        std::vector<gint64> sorted(samples.begin(), samples.end());
+        size_t index = std::min(sorted.size() - 1, sorted.size() * percent / 100);
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index] / 1000.0;
+    }
+};
+
+// Dodatkowy terminal podzielonej zakładki (zagnieżdżone GtkPaned). Nagrywanie,
+// pomiar opóźnienia i zrzut historii dotyczą tylko głównego terminala zakładki.
+struct TerminalPane {
+    GtkWidget *terminal = nullptr;
+    GPid child_pid = 0;
+};
+
+class TerminalTab {
+public:
+    GtkWidget *page;      // strona notebooka, terminal jest do niej dodawany przy pierwszym użyciu
+    GtkWidget *terminal;  // nullptr, dopóki zakładka nie została zmaterializowana
+    GtkWidget *label;
+    GtkWidget *tab_container;
+    GtkWidget *close_button;
+    std::string title;
+    std::string working_directory;  // katalog startowy powłoki
+    GPid child_pid;
+    gint64 last_viewed;  // czas ostatniego wyświetlenia (g_get_monotonic_time)
+    bool read_only;      // podgląd zapisanej historii, bez powłoki
+    std::vector<std::string> spill_files;  // historia zrzucona na dysk, od najstarszej
+    
+    // Nagrywana zakładka: powłoka działa na własnym PTY, a jej wyjście trafia
+    // do rejestratora i dopiero potem do terminala (vte_terminal_feed)
+    OutputRecorder *recorder;
+    VtePty *proxy_pty;
+    guint proxy_source_id;
+    std::string proxy_pending;      // wejście czekające na miejsce w buforze PTY
+    guint proxy_write_source_id;
+    GCancellable *spawn_cancellable;
+    
+    LatencyProbe *latency;  // nullptr, gdy latency_probe jest wyłączone
+    
+    std::vector<TerminalPane*> panes;  // pozostałe terminale podzielonej zakładki
+    GtkWidget *focused_terminal;       // ostatnio aktywny terminal, nullptr = główny
+    
+    // Control API: stały identyfikator, polecenie zamiast powłoki (puste = $SHELL)
+    // i tekst czekający na podłączenie PTY, osobno dla każdego terminala zakładki
+    unsigned id;
+    std::vector<std::string> command;
+    std::map<GtkWidget*, std::string> pending_input;
+    
+    bool broadcast;               // w grupie rozgłaszania wejścia swojego okna
+    GtkWidget *broadcast_icon;    // wskaźnik na karcie, widoczny tylko w grupie
+
+    TerminalTab(GtkNotebook *notebook, const std::string &title = "Terminal")
+        : terminal(nullptr), title(title), child_pid(0), last_viewed(g_get_monotonic_time()), read_only(false),
+          recorder(nullptr), proxy_pty(nullptr), proxy_source_id(0), proxy_write_source_id(0), spawn_cancellable(g_cancellable_new()),
+          latency(nullptr), focused_terminal(nullptr), id(next_id++), broadcast(false), broadcast_icon(nullptr) {
+        // Pola page, label, tab_container i close_button będą ustawione w add_new_tab
+    }
+    
+    ~TerminalTab() {
+        release_terminal();
+        g_object_unref(spawn_cancellable);
+        
+        for (auto pane : panes) {
+            if (pane->child_pid > 0) {
+                kill(pane->child_pid, SIGTERM);
+            }
+            delete pane;
+        }
+    }
+    
+    static inline unsigned next_id = 1;
+    
+    // Terminal, do którego trafiają skróty i wyszukiwanie
+    GtkWidget *active_terminal() const {
+        return focused_terminal ? focused_terminal : terminal;
+    }
+    
+    // Bez alokacji - wywoływane przy każdym rozgłaszanym naciśnięciu klawisza
+    bool owns_terminal(GtkWidget *widget) const {
+        if (widget == terminal) return true;
+        for (auto pane : panes) {
+            if (pane->terminal == widget) return true;
+        }
+        return false;
+    }
+    
+    std::vector<GtkWidget*> all_terminals() const {
+        std::vector<GtkWidget*> terminals;
+        if (terminal) terminals.push_back(terminal);
+        for (auto pane : panes) {
+            terminals.push_back(pane->terminal);
+        }
+        return terminals;
+    }
+    
+    // Zwalnia zasoby głównego terminala: przy usuwaniu zakładki albo przy
+    // zamknięciu go w podzielonej zakładce, gdy jego miejsce zajmuje inny panel
+    void release_terminal() {
+        // Spawn w toku nie może już odwołać się do zwolnionego terminala
+        g_cancellable_cancel(spawn_cancellable);
+        g_object_unref(spawn_cancellable);
+        spawn_cancellable = g_cancellable_new();
         
-        while (std::getline(theme_file, line)) {
-            // Pomijanie pustych linii
-            if (line.empty()) continue;
+        if (child_pid > 0) {
+            kill(child_pid, SIGTERM);
+            child_pid = 0;
+        }
+        if (proxy_source_id != 0) {
+            g_source_remove(proxy_source_id);
+            proxy_source_id = 0;
+        }
+        if (proxy_write_source_id != 0) {
+            g_source_remove(proxy_write_source_id);
+            proxy_write_source_id = 0;
+        }
+        proxy_pending.clear();
+        if (proxy_pty) {
+            g_object_unref(proxy_pty);
+            proxy_pty = nullptr;
+        }
+        if (recorder) {
+            recorder->close();
+            recorder = nullptr;
+        }
+        for (const auto &path : spill_files) {
+            unlink(path.c_str());
+        }
+        spill_files.clear();
+        delete latency;
+        latency = nullptr;
+    }
+};
+
+class TerminalWindow;
+
+// Recently used search patterns, compiled once for VTE (PCRE2, JIT-compiled
+// where available) and once as a GRegex for background matching. Refining a
+// query in the search bar usually comes back to a pattern already in here.
+class RegexCache {
+public:
+    struct Entry {
+        VteRegex *vte_regex;
+        GRegex *regex;
+    };
+    
+    static constexpr size_t CAPACITY = 32;
+    
+    // Returns a cached entry owned by the cache; on error returns nullptr and sets error
+    static const Entry *lookup(const std::string &text, bool is_regex, bool case_sensitive, GError **error) {
+        std::string key = std::string(is_regex ? "r" : "l") + (case_sensitive ? "c" : "i") + text;
+        
+        auto found = index.find(key);
+        if (found != index.end()) {
+            entries.splice(entries.begin(), entries, found->second);
+            return &found->second->second;
+        }
+        
+        gchar *pattern = is_regex ? g_strdup(text.c_str()) : g_regex_escape_string(text.c_str(), -1);
+        VteRegex *vte_regex = vte_regex_new_for_search(pattern, -1,
+                                                       PCRE2_MULTILINE | (case_sensitive ? 0 : PCRE2_CASELESS), error);
+        GRegex *regex = NULL;
+        if (vte_regex) {
+            // Brak JIT (np. na platformie bez wsparcia) nie jest błędem - VTE dopasuje bez niego
+            vte_regex_jit(vte_regex, PCRE2_JIT_COMPLETE, NULL);
+            regex = g_regex_new(pattern, (GRegexCompileFlags)(G_REGEX_OPTIMIZE | (case_sensitive ? 0 : G_REGEX_CASELESS)),
+                                (GRegexMatchFlags)0, error);
+        }
+        g_free(pattern);
+        
+        if (!regex) {
+            if (vte_regex) vte_regex_unref(vte_regex);
+            return nullptr;
+        }
+        
+        entries.push_front({key, {vte_regex, regex}});
+        index[key] = entries.begin();
+        if (entries.size() > CAPACITY) {
+            auto &oldest = entries.back();
+            vte_regex_unref(oldest.second.vte_regex);
+            g_regex_unref(oldest.second.regex);
+            index.erase(oldest.first);
+            entries.pop_back();
+        }
+        return &entries.front().second;
+    }
+
+private:
+    static inline std::list<std::pair<std::string, Entry>> entries;
+    static inline std::map<std::string, std::list<std::pair<std::string, Entry>>::iterator> index;
+};
+
+// Searches text snapshots of many tabs on a pool of worker threads. VTE is not
+// thread-safe, so snapshots are taken on the GTK thread and handed over with
+// add(); workers only run the regex over plain strings. Hits are collected
+// under a mutex and picked up by the GTK thread with take_hits().
+class TabSearch {
+public:
+    struct Snapshot {
+        unsigned tab_id;   // TerminalTab::id, zakładka może zniknąć przed aktywacją wyniku
+        std::string title;
+        glong first_row;   // wiersz VTE pierwszej linii tekstu
+        glong columns;     // szerokość terminala - według niej VTE zawija linie
+        std::string text;
+    };
+    
+    struct Hit {
+        unsigned tab_id;
+        std::string title;
+        glong row;
+        std::string context;
+    };
+    
+    static constexpr size_t MAX_HITS = 10000;
+    static constexpr size_t MAX_CONTEXT = 200;
+
+    // Takes ownership of the regex
+    TabSearch(GRegex *regex) : regex(regex) {
+        unsigned count = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+        running_workers = count;
+        for (unsigned i = 0; i < count; i++) {
+            workers.emplace_back(&TabSearch::worker_loop, this);
+        }
+    }
+    
+    ~TabSearch() {
+        cancel();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        g_regex_unref(regex);
+    }
+    
+    void add(Snapshot &&snapshot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(snapshot));
+        }
+        cv.notify_one();
+    }
+    
+    // No more snapshots will be added; workers exit once the queue is empty
+    void finish_input() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            input_finished = true;
+        }
+        cv.notify_all();
+    }
+    
+    void cancel() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+            input_finished = true;
+            queue.clear();
+        }
+        cv.notify_all();
+    }
+    
+    // Returns hits found since the last call; done is set when all workers finished
+    std::vector<Hit> take_hits(bool &done) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Hit> result;
+        result.swap(hits);
+        done = running_workers == 0;
+        return result;
+    }
+    
+    bool hit_limit_reached() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total_hits >= MAX_HITS;
+    }
+
+private:
+    GRegex *regex;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Snapshot> queue;
+    std::vector<Hit> hits;
+    size_t total_hits = 0;
+    unsigned running_workers = 0;
+    bool input_finished = false;
+    std::atomic<bool> cancelled{false};  // sprawdzane także bez blokady w trakcie skanowania
+    
+    void worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return input_finished || !queue.empty(); });
+            if (queue.empty() || cancelled) {
+                break;
+            }
+            
+            Snapshot snapshot = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            
+            std::vector<Hit> found = scan(snapshot);
             
-            // Sprawdzanie, czy linia jest sekcją
-            if (line[0] == '[' && line[line.length() - 1] == ']') {
-                current_section = line.substr(1, line.length() - 2);
+            lock.lock();
+            for (auto &hit : found) {
+                if (total_hits >= MAX_HITS) break;
+                hits.push_back(std::move(hit));
+                total_hits++;
+            }
+        }
+        running_workers--;
+    }
+    
+    // Liczba wierszy VTE zajmowanych przez linię tekstu: VTE zawija ją co
+    // columns komórek, a szeroki znak, który nie mieści się na końcu wiersza,
+    // przechodzi w całości do następnego. Tabulator nie zawija linii.
+    static glong wrapped_rows(const std::string &line, glong columns) {
+        if (columns <= 0) return 1;
+        glong rows = 1;
+        glong column = 0;
+        for (const char *p = line.c_str(); *p; p = g_utf8_next_char(p)) {
+            gunichar c = g_utf8_get_char(p);
+            if (c == '\t') {
+                column += std::min(8 - column % 8, columns - column);
                 continue;
             }
+            glong width = g_unichar_iszerowidth(c) ? 0 : g_unichar_iswide(c) ? 2 : 1;
+            if (column + width > columns) {
+                rows++;
+                column = 0;
+            }
+            column += width;
+        }
+        return rows;
+    }
+    
+    // Linie tekstu są rozdzielone '\n', a zawinięta linia zajmuje kilka wierszy VTE
+    std::vector<Hit> scan(const Snapshot &snapshot) {
+        std::vector<Hit> found;
+        size_t start = 0;
+        glong row = snapshot.first_row;
+        
+        while (start < snapshot.text.size() && found.size() < MAX_HITS && !cancelled) {
+            size_t end = snapshot.text.find('\n', start);
+            if (end == std::string::npos) end = snapshot.text.size();
             
-            // Przetwarzanie par klucz=wartość
-            size_t pos = line.find('=');
-            if (pos != std::string::npos) {
-                std::string key = line.substr(0, pos);
-                std::string value = line.substr(pos + 1);
-                
-                if (current_section == "Theme") {
-                    if (key == "name") {
-                        theme.name = value;
-                    } else if (key == "foreground") {
-                        parse_color(value, theme.foreground);
-                    } else if (key == "background") {
-                        parse_color(value, theme.background);
-                    } else if (key == "transparency") {
-                        // Nie wczytujemy przezroczystości motywu, używamy globalnej przezroczystości
-                        // theme.transparency = std::stod(value);
-                        theme.transparency = transparency;
-                    }
-                } else if (current_section == "Palette") {
-                    // Sprawdź, czy klucz ma format "colorN"
-                    if (key.length() > 5 && key.substr(0, 5) == "color") {
-                        int index = std::stoi(key.substr(5));
-                        if (index >= 0 && index < 16) {
-                            parse_color(value, theme.palette[index]);
-                        }
-                    }
+            std::string line = snapshot.text.substr(start, end - start);
+            glong line_rows = wrapped_rows(line, snapshot.columns);
+            if (g_regex_match(regex, line.c_str(), (GRegexMatchFlags)0, NULL)) {
+                if (line.size() > MAX_CONTEXT) {
+                    const char *cut = g_utf8_find_prev_char(line.c_str(), line.c_str() + MAX_CONTEXT + 1);
+                    line.resize(cut ? cut - line.c_str() : MAX_CONTEXT);
                 }
+                found.push_back({snapshot.tab_id, snapshot.title, row, line});
             }
+            
+            start = end + 1;
+            row += line_rows;
         }
-        
-        theme_file.close();
-        
-        // Dodaj motyw do mapy, jeśli ma nazwę
-        if (!theme.name.empty()) {
-            color_themes[theme.name] = theme;
-            std::cerr << "Wczytano motyw: " << theme.name << std::endl;
+        return found;
+    }
+};
+
+// Counts every regex match in the text of one tab on a single long-lived
+// worker thread. A new request() supersedes the one in progress, which is
+// abandoned mid-scan; the GTK thread polls result() for the generation it
+// asked for. The text is shared, so repeated requests do not copy it.
+class MatchCounter {
+public:
+    static constexpr size_t MAX_MATCHES = TabSearch::MAX_HITS;
+    
+    MatchCounter() : worker(&MatchCounter::worker_loop, this) {}
+    
+    ~MatchCounter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+        if (pending_regex) {
+            g_regex_unref(pending_regex);
         }
     }
     
-private:
-    // Parsowanie koloru z formatu "r,g,b,a"
-    void parse_color(const std::string& color_str, GdkRGBA& color) {
-        std::istringstream ss(color_str);
-        std::string token;
-        
-        if (std::getline(ss, token, ',')) {
-            color.red = std::stod(token);
+    // Takes ownership of the regex; returns the generation of the request
+    unsigned request(GRegex *regex, std::shared_ptr<const std::string> text) {
+        unsigned generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending_regex) {
+                g_regex_unref(pending_regex);
+            }
+            pending_regex = regex;
+            pending_text = std::move(text);
+            generation = ++latest;
         }
-        if (std::getline(ss, token, ',')) {
-            color.green = std::stod(token);
+        cv.notify_one();
+        return generation;
+    }
+    
+    // True once the count for the given generation is ready
+    bool result(unsigned generation, size_t &count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (done_generation != generation) {
+            return false;
         }
-        if (std::getline(ss, token, ',')) {
-            color.blue = std::stod(token);
+        count = done_count;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    GRegex *pending_regex = nullptr;
+    std::shared_ptr<const std::string> pending_text;
+    std::atomic<unsigned> latest{0};   // sprawdzane bez blokady w trakcie skanowania
+    unsigned done_generation = 0;
+    size_t done_count = 0;
+    bool stopping = false;
+    std::thread worker;   // ostatnie pole, wątek startuje po inicjalizacji pozostałych
+    
+    void worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return stopping || pending_regex; });
+            if (stopping) {
+                break;
+            }
+            
+            GRegex *regex = pending_regex;
+            std::shared_ptr<const std::string> text = std::move(pending_text);
+            unsigned generation = latest;
+            pending_regex = nullptr;
+            lock.unlock();
+            
+            size_t count = 0;
+            bool complete = count_matches(regex, *text, generation, count);
+            g_regex_unref(regex);
+            
+            lock.lock();
+            if (complete) {
+                done_generation = generation;
+                done_count = count;
+            }
         }
-        if (std::getline(ss, token, ',')) {
-            color.alpha = std::stod(token);
+    }
+    
+    // Linia po linii, żeby ^ i $ działały jak w wyszukiwaniu VTE; liczy każde wystąpienie
+    bool count_matches(GRegex *regex, const std::string &text, unsigned generation, size_t &count) {
+        size_t start = 0;
+        while (start < text.size() && count < MAX_MATCHES) {
+            if (latest != generation) {
+                return false;
+            }
+            size_t end = text.find('\n', start);
+            if (end == std::string::npos) end = text.size();
+            
+            std::string line = text.substr(start, end - start);
+            GMatchInfo *match_info = NULL;
+            g_regex_match(regex, line.c_str(), (GRegexMatchFlags)0, &match_info);
+            while (g_match_info_matches(match_info) && count < MAX_MATCHES) {
+                count++;
+                g_match_info_next(match_info, NULL);
+            }
+            g_match_info_free(match_info);
+            
+            start = end + 1;
         }
+        return true;
     }
 };
 
-class TerminalTab {
+// Session snapshot: tabs of every window in notebook order, their titles and
+// working directories. Text format, one record per line, fields escaped with
+// g_strescape and separated by tabs:
+//   lum-session <version>
+//   window <current page>
+//   tab <title> <working directory>
+class SessionStore {
 public:
-    GtkWidget *terminal;
-    GtkWidget *label;
-    GtkWidget *tab_container;
-    GtkWidget *close_button;
-    std::string title;
-    GPid child_pid;
+    struct Tab {
+        std::string title;
+        std::string working_directory;
+    };
+    
+    struct Window {
+        int current_page = 0;
+        std::vector<Tab> tabs;
+    };
 
-    TerminalTab(GtkNotebook *notebook, const std::string &title = "Terminal") : title(title), child_pid(0) {
-        // Pola terminal, label, tab_container i close_button będą ustawione w add_new_tab
+    static std::string get_session_path() {
+        return std::string(g_get_user_cache_dir()) + "/lum-terminal/session";
     }
     
-    ~TerminalTab() {
-        if (child_pid > 0) {
-            kill(child_pid, SIGTERM);
+    static std::string serialize(const std::vector<Window> &session) {
+        std::string data = std::string(MAGIC) + " " + std::to_string(VERSION) + "\n";
+        for (const auto &window : session) {
+            data += "window\t" + std::to_string(window.current_page) + "\n";
+            for (const auto &tab : window.tabs) {
+                data += "tab\t" + escape(tab.title) + "\t" + escape(tab.working_directory) + "\n";
+            }
+        }
+        return data;
+    }
+    
+    // Returns false if the file is missing or was written by another version
+    static bool load(const std::string &path, std::vector<Window> &session) {
+        std::ifstream file(path);
+        std::string line;
+        if (!std::getline(file, line) || line != std::string(MAGIC) + " " + std::to_string(VERSION)) {
+            return false;
+        }
+        
+        while (std::getline(file, line)) {
+            gchar **fields = g_strsplit(line.c_str(), "\t", -1);
+            guint count = g_strv_length(fields);
+            
+            if (count == 2 && strcmp(fields[0], "window") == 0) {
+                Window window;
+                window.current_page = atoi(fields[1]);
+                session.push_back(window);
+            } else if (count == 3 && strcmp(fields[0], "tab") == 0 && !session.empty()) {
+                gchar *title = g_strcompress(fields[1]);
+                gchar *working_directory = g_strcompress(fields[2]);
+                session.back().tabs.push_back({title, working_directory});
+                g_free(title);
+                g_free(working_directory);
+            }
+            g_strfreev(fields);
         }
+        return true;
+    }
+
+private:
+    static constexpr const char *MAGIC = "lum-session";
+    static constexpr int VERSION = 1;
+    
+    static std::string escape(const std::string &value) {
+        gchar *escaped = g_strescape(value.c_str(), NULL);
+        std::string result = escaped;
+        g_free(escaped);
+        return result;
     }
 };
 
 class TerminalWindow {
 public:
-    TerminalWindow() {
-        // Inicjalizacja GTK
-        gtk_init(nullptr, nullptr);
+    // Wszystkie okna działające w tym procesie (współdzielą jedną konfigurację)
+    static inline std::vector<TerminalWindow*> windows;
+
+    // Okno nie uruchamia własnej pętli GTK - gtk_init i gtk_main wywołuje main(),
+    // dzięki czemu jeden proces może obsługiwać wiele okien
+    // Zakładki z extra_tabs są tylko deklarowane - powłoka startuje przy pierwszym
+    // przełączeniu na nie albo w tle, jeśli włączono background_tab_spawn
+    TerminalWindow(TerminalConfig &config, const std::string &working_directory = "",
+                   const std::vector<std::string> &extra_tabs = {})
+        : config(config), materialize_idle_id(0) {
+        build_window();
         
-        // Wczytanie konfiguracji
-        config.load_config();
+        // Dodanie pierwszej zakładki
+        {
+            StartupProfiler::Scope profile("add_new_tab");
+            add_new_tab("Terminal", working_directory);
+        }
+        
+        for (const auto &directory : extra_tabs) {
+            add_new_tab("Terminal", directory, true);
+        }
+        if (config.background_tab_spawn && has_pending_tabs()) {
+            materialize_idle_id = g_idle_add_full(G_PRIORITY_LOW, on_materialize_idle, this, NULL);
+        }
+
+        // Wyświetlenie okna
+        gtk_widget_show_all(window);
+    }
+    
+    // Okno odtworzone z sesji: od razu powstaje tylko bieżąca zakładka, pozostałe
+    // są uruchamiane w kolejnych przebiegach pętli - spawn jest asynchroniczny,
+    // więc powłoki startują równolegle, a okno jest gotowe po pierwszej z nich
+    TerminalWindow(TerminalConfig &config, const SessionStore::Window &session)
+        : config(config), materialize_idle_id(0) {
+        build_window();
+        
+        // Dodanie pierwszej strony przełącza na nią notebook - bez tej blokady
+        // on_tab_switch uruchomiłby od razu powłokę pierwszej zakładki
+        restoring_tabs = true;
+        for (const auto &tab : session.tabs) {
+            add_new_tab(tab.title, tab.working_directory, true);
+        }
+        if (tabs.empty()) {
+            add_new_tab();
+        }
+        
+        int current_page = std::clamp(session.current_page, 0, (int)tabs.size() - 1);
+        gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), current_page);
+        restoring_tabs = false;
+        materialize_tab(tabs[current_page]);
+        gtk_widget_grab_focus(tabs[current_page]->active_terminal());
+        
+        if (has_pending_tabs()) {
+            materialize_idle_id = g_idle_add_full(G_PRIORITY_LOW, on_materialize_idle, this, NULL);
+        }
+        
+        gtk_widget_show_all(window);
+    }
+    
+    // Okno odtwarzające nagranie asciicast (--replay). W trybie fast dane są
+    // podawane tak szybko, jak terminal je przyjmuje, a po ostatniej klatce
+    // wypisywana jest przepustowość i okno się zamyka. Nagranie ze zdarzeniami
+    // wejścia ("i") steruje prawdziwą powłoką. Okno headless (--headless)
+    // rysuje poza ekranem i zamyka się po raporcie także bez trybu fast.
+    TerminalWindow(TerminalConfig &config, const std::string &replay_path, Asciicast::Recording &&recording, bool fast,
+                   bool headless = false)
+        : config(config), materialize_idle_id(0), replay_window(true), headless(headless) {
+        build_window(headless);
+        
+        bool has_input = std::any_of(recording.events.begin(), recording.events.end(),
+                                     [](const Asciicast::Event &event) { return event.type == 'i'; });
+        
+        gchar *name = g_path_get_basename(replay_path.c_str());
+        TerminalTab *tab = add_new_tab(std::string("Replay: ") + name, "", false, !has_input);
+        g_free(name);
+        
+        VteTerminal *terminal = VTE_TERMINAL(tab->terminal);
+        vte_terminal_set_scrollback_lines(terminal, config.scrollback_lines);
+        vte_terminal_set_size(terminal, recording.columns, recording.rows);
+        
+        replay = new ReplayState();
+        replay->recording = std::move(recording);
+        replay->tab = tab;
+        replay->fast = fast;
+        replay->has_input = has_input;
+        replay->terminal = GTK_WIDGET(g_object_ref(tab->terminal));
+        replay->draw_handler = g_signal_connect(tab->terminal, "draw", G_CALLBACK(on_replay_draw_start), this);
+        replay->draw_after_handler = g_signal_connect_after(tab->terminal, "draw", G_CALLBACK(on_replay_draw_end), this);
+        if (has_input) {
+            replay->contents_handler = g_signal_connect(tab->terminal, "contents-changed",
+                                                        G_CALLBACK(on_replay_contents_changed), this);
+        }
+        
+        gtk_widget_show_all(window);
+        connect_replay_frame_clock();
+        
+        replay->start_time = g_get_monotonic_time();
+        if (fast) {
+            replay->source_id = g_idle_add(on_replay_step, this);
+        } else {
+            replay->source_id = g_timeout_add(0, on_replay_step, this);
+        }
+    }
+    
+    // Otwiera okna zapisanej sesji; zwraca false, jeśli nie było czego odtworzyć
+    static bool restore_session(TerminalConfig &config) {
+        std::vector<SessionStore::Window> session;
+        if (!SessionStore::load(SessionStore::get_session_path(), session)) {
+            return false;
+        }
+        
+        bool restored = false;
+        for (const auto &window : session) {
+            if (window.tabs.empty()) continue;
+            TerminalWindow *win = new TerminalWindow(config, window);
+            win->present();
+            restored = true;
+        }
+        return restored;
+    }
+    
+    // Control API (InstanceServer). Zakładki są adresowane identyfikatorem,
+    // który nie zmienia się przy przesuwaniu kart ani zamykaniu innych zakładek.
+    static TerminalTab *find_tab(unsigned id, TerminalWindow **owner) {
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                if (tab->id == id) {
+                    *owner = win;
+                    return tab;
+                }
+            }
+        }
+        return nullptr;
+    }
+    
+    // Trójki: identyfikator, tytuł, bieżący katalog
+    static std::vector<std::string> control_list() {
+        std::vector<std::string> fields;
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                GPid pid = tab->terminal ? get_terminal_pid(tab, tab->active_terminal()) : 0;
+                fields.push_back(std::to_string(tab->id));
+                fields.push_back(tab->title);
+                fields.push_back(get_process_directory(pid, tab->working_directory));
+            }
+        }
+        return fields;
+    }
+    
+    // Nowa zakładka w ostatnio otwartym oknie (poza oknami odtwarzania); nie
+    // zabiera fokusu bieżącej zakładce. Zwraca 0, gdy nie ma okna.
+    static unsigned control_open(const std::string &working_directory, const std::vector<std::string> &command) {
+        auto found = std::find_if(windows.rbegin(), windows.rend(),
+                                  [](TerminalWindow *win) { return !win->replay_window; });
+        if (found == windows.rend()) return 0;
+        TerminalWindow *win = *found;
+        
+        std::string title = "Terminal";
+        if (!command.empty()) {
+            gchar *name = g_path_get_basename(command[0].c_str());
+            title = name;
+            g_free(name);
+        }
+        
+        TerminalTab *tab = win->add_new_tab(title, working_directory, true);
+        tab->command = command;
+        win->materialize_tab(tab);
+        return tab->id;
+    }
+    
+    static bool control_send(unsigned id, const std::string &text) {
+        TerminalWindow *win;
+        TerminalTab *tab = find_tab(id, &win);
+        if (!tab || tab->read_only) return false;
+        win->materialize_tab(tab);
+        
+        // Powłoka startuje asynchronicznie - tekst wysłany zaraz po "open" czeka,
+        // aż terminal dostanie PTY
+        feed_child_when_ready(tab, VTE_TERMINAL(tab->active_terminal()), text.data(), text.size());
+        return true;
+    }
+    
+    // Wejście dla powłoki, która mogła jeszcze nie wystartować (spawn jest
+    // asynchroniczny): bez PTY czeka w pending_input do notify::pty
+    static void feed_child_when_ready(TerminalTab *tab, VteTerminal *terminal, const char *text, size_t size) {
+        // Własne PTY nagrywanej zakładki należy tylko do jej głównego terminala
+        GtkWidget *widget = GTK_WIDGET(terminal);
+        bool attached = (widget == tab->terminal && tab->proxy_pty) || vte_terminal_get_pty(terminal);
+        if (!attached) {
+            std::string &pending = tab->pending_input[widget];
+            if (pending.empty()) {
+                g_signal_connect(terminal, "notify::pty", G_CALLBACK(on_input_pty_ready), tab);
+            }
+            pending.append(text, size);
+            return;
+        }
+        vte_terminal_feed_child(terminal, text, size);
+    }
+    
+    static void on_input_pty_ready(GObject *object, GParamSpec *pspec, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        VteTerminal *terminal = VTE_TERMINAL(object);
+        if (!vte_terminal_get_pty(terminal)) return;
+        
+        g_signal_handlers_disconnect_by_func(terminal, (gpointer)on_input_pty_ready, tab);
+        auto pending = tab->pending_input.find(GTK_WIDGET(terminal));
+        if (pending == tab->pending_input.end()) return;
+        std::string text = std::move(pending->second);
+        tab->pending_input.erase(pending);
+        vte_terminal_feed_child(terminal, text.data(), text.size());
+    }
+    
+    // Tekst widocznego ekranu albo całej historii (scrollback) aktywnego terminala
+    static bool control_read(unsigned id, bool scrollback, std::string &text) {
+        TerminalWindow *win;
+        TerminalTab *tab = find_tab(id, &win);
+        if (!tab) return false;
+        text.clear();
+        if (!tab->terminal) return true;  // niezmaterializowana zakładka jest pusta
+        
+        VteTerminal *terminal = VTE_TERMINAL(tab->active_terminal());
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        glong first_row, last_row;
+        if (scrollback) {
+            first_row = (glong)gtk_adjustment_get_lower(adjustment);
+            last_row = (glong)gtk_adjustment_get_upper(adjustment) - 1;
+        } else {
+            first_row = (glong)gtk_adjustment_get_value(adjustment);
+            last_row = first_row + vte_terminal_get_row_count(terminal) - 1;
+        }
+        
+        text = get_text_rows(terminal, first_row, last_row);
+        return true;
+    }
+    
+    // Tekst pełnych wierszy first_row..last_row; linie zawinięte przez VTE nie
+    // mają '\n'. get_text_range jest od VTE 0.76 przestarzałe.
+    static std::string get_text_rows(VteTerminal *terminal, glong first_row, glong last_row) {
+        glong columns = vte_terminal_get_column_count(terminal);
+#if VTE_CHECK_VERSION(0, 72, 0)
+        gchar *text = vte_terminal_get_text_range_format(terminal, VTE_FORMAT_TEXT, first_row, 0, last_row, columns, NULL);
+#else
+        gchar *text = vte_terminal_get_text_range(terminal, first_row, 0, last_row, columns - 1, NULL, NULL, NULL);
+#endif
+        std::string result = text ? text : "";
+        g_free(text);
+        return result;
+    }
+    
+    // Skrypt zamyka zakładkę bez pytania o uruchomione procesy
+    static bool control_close(unsigned id) {
+        TerminalWindow *win;
+        TerminalTab *tab = find_tab(id, &win);
+        if (!tab) return false;
+        auto position = std::find(win->tabs.begin(), win->tabs.end(), tab);
+        win->close_tab(position - win->tabs.begin(), false);
+        return true;
+    }
+    
+    // Uruchamia, zmienia lub wyłącza próbkowanie procesów według process_monitor_seconds
+    static void apply_process_monitor() {
+        if (windows.empty()) return;
+        int interval_s = windows.front()->config.process_monitor_seconds;
+        
+        if (process_monitor_timeout_id != 0) {
+            g_source_remove(process_monitor_timeout_id);
+            process_monitor_timeout_id = 0;
+        }
+        if (interval_s <= 0) {
+            ProcessMonitor::stop();
+            for (auto win : windows) {
+                for (auto tab : win->tabs) {
+                    gtk_widget_set_tooltip_text(tab->label, NULL);
+                }
+            }
+            return;
+        }
+        
+        ProcessMonitor::start(interval_s);
+        process_monitor_timeout_id = g_timeout_add_seconds(interval_s, on_process_monitor_timeout, NULL);
+        on_process_monitor_timeout(NULL);
+    }
+    
+    // Wyniki dotyczą poprzedniego przebiegu próbkowania, nowe zakładki pojawiają się w następnym
+    static gboolean on_process_monitor_timeout(gpointer data) {
+        std::vector<GPid> roots;
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                if (tab->child_pid > 0) roots.push_back(tab->child_pid);
+                for (auto pane : tab->panes) {
+                    if (pane->child_pid > 0) roots.push_back(pane->child_pid);
+                }
+            }
+        }
+        ProcessMonitor::set_roots(roots);
+        
+        std::map<GPid, ProcessMonitor::Usage> usage = ProcessMonitor::get_usage();
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                // Panele podzielonej zakładki sumują się w jednej podpowiedzi
+                ProcessMonitor::Usage total;
+                std::vector<GPid> shells = {tab->child_pid};
+                for (auto pane : tab->panes) {
+                    shells.push_back(pane->child_pid);
+                }
+                for (GPid shell : shells) {
+                    auto found = usage.find(shell);
+                    if (shell <= 0 || found == usage.end()) continue;
+                    total.cpu_percent += found->second.cpu_percent;
+                    total.rss_bytes += found->second.rss_bytes;
+                    total.processes += found->second.processes;
+                }
+                if (total.processes == 0) {
+                    gtk_widget_set_tooltip_text(tab->label, NULL);
+                    continue;
+                }
+                gchar *text = g_strdup_printf("CPU %.1f%%, memory %.1f MB (%d %s)",
+                                              total.cpu_percent, total.rss_bytes / (1024.0 * 1024.0),
+                                              total.processes, total.processes == 1 ? "process" : "processes");
+                gtk_widget_set_tooltip_text(tab->label, text);
+                g_free(text);
+            }
+        }
+        return G_SOURCE_CONTINUE;
+    }
+    
+    // Wypisuje percentyle opóźnień wszystkich zakładek (SIGUSR1, latency_probe=true)
+    static gboolean on_latency_dump_signal(gpointer data) {
+        if (windows.empty()) return G_SOURCE_CONTINUE;
+        
+        const TerminalConfig &config = windows.front()->config;
+        g_printerr("Keypress-to-frame latency (font %s %.1f, theme %s, transparency %.2f, %s render path):\n",
+                   config.font_family.c_str(), config.font_size, config.current_theme_name.c_str(), config.transparency,
+                   config.uses_alpha() ? "alpha" : "opaque");
+        for (size_t w = 0; w < windows.size(); w++) {
+            for (size_t t = 0; t < windows[w]->tabs.size(); t++) {
+                TerminalTab *tab = windows[w]->tabs[t];
+                if (!tab->latency) continue;
+                
+                LatencyProbe::Summary summary = tab->latency->summary();
+                if (summary.samples == 0) {
+                    g_printerr("  window %zu tab %zu (%s): no samples\n", w + 1, t + 1, tab->title.c_str());
+                    continue;
+                }
+                g_printerr("  window %zu tab %zu (%s): %zu samples, p50 %.1f ms, p95 %.1f ms, p99 %.1f ms "
+                           "(dispatch p50 %.2f ms, echo p50 %.1f ms)\n",
+                           w + 1, t + 1, tab->title.c_str(), summary.samples, summary.p50, summary.p95, summary.p99,
+                           summary.dispatch_p50, summary.echo_p50);
+            }
+        }
+        return G_SOURCE_CONTINUE;
+    }
+    
+    // Zapisuje stan wszystkich okien przez wątek zapisu konfiguracji.
+    // Niezmieniona sesja nie jest zapisywana ponownie.
+    static void save_session() {
+        if (windows.empty()) return;
+        
+        // Okna --replay nie należą do sesji (inaczej benchmark nadpisałby sesję użytkownika).
+        // Okno bez zakładek - np. po wyjściu z ostatniej powłoki - też nie, żeby
+        // pusta sesja nie zastąpiła poprzedniej.
+        std::vector<SessionStore::Window> session;
+        for (auto win : windows) {
+            if (win->replay_window) continue;
+            SessionStore::Window snapshot = win->snapshot();
+            if (!snapshot.tabs.empty()) {
+                session.push_back(std::move(snapshot));
+            }
+        }
+        if (session.empty()) return;
+        
+        std::string data = SessionStore::serialize(session);
+        if (data == last_saved_session) return;
+        last_saved_session = data;
+        
+        std::string path = SessionStore::get_session_path();
+        gchar *session_dir = g_path_get_dirname(path.c_str());
+        g_mkdir_with_parents(session_dir, 0700);
+        g_free(session_dir);
+        windows.front()->config.write_file_async(path, data);
+    }
+    
+private:
+    // W trybie headless okno jest GtkOffscreenWindow - ma ten sam notebook
+    // i terminale, ale rysuje do bufora w pamięci i nie pojawia się na ekranie
+    void build_window(bool headless = false) {
+        windows.push_back(this);
         
         // Tworzenie głównego okna
-        window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        window = headless ? gtk_offscreen_window_new() : gtk_window_new(GTK_WINDOW_TOPLEVEL);
         gtk_window_set_title(GTK_WINDOW(window), "Lum Terminal");
         gtk_window_set_default_size(GTK_WINDOW(window), 800, 500);
         gtk_window_set_role(GTK_WINDOW(window), "lum-terminal");  // Rola okna
         gtk_window_set_wmclass(GTK_WINDOW(window), "LumTerminal", "Lum Terminal");  // Nazwa klasy aplikacji
         
-        // Włączamy obsługę przezroczystości dla całego okna
-        GdkScreen *screen = gtk_widget_get_screen(window);
-        GdkVisual *visual = gdk_screen_get_rgba_visual(screen);
-        if (visual != NULL) {
-            gtk_widget_set_visual(window, visual);
-        }
-        gtk_widget_set_app_paintable(window, TRUE);
+        // Wizual RGBA tylko wtedy, gdy przezroczystość jest włączona
+        set_render_path(config.uses_alpha());
 
         g_signal_connect(window, "delete-event", G_CALLBACK(on_window_delete), this);
+        g_signal_connect(window, "destroy", G_CALLBACK(on_window_destroy), this);
+        
+        if (StartupProfiler::is_active()) {
+            g_signal_connect(window, "realize", G_CALLBACK(on_window_realize_profile), NULL);
+        }
+        if (config.latency_probe) {
+            g_signal_connect(window, "realize", G_CALLBACK(on_window_realize_latency), this);
+        }
+        
+        gint64 menus_start = g_get_monotonic_time();
         g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), this);
 
         // Tworzenie headerbar (pasek tytułowy w stylu GNOME)
-        GtkWidget *headerbar = gtk_header_bar_new();
+        headerbar = gtk_header_bar_new();
         gtk_header_bar_set_show_close_button(GTK_HEADER_BAR(headerbar), TRUE);
         gtk_header_bar_set_title(GTK_HEADER_BAR(headerbar), "Lum Terminal");
         gtk_window_set_titlebar(GTK_WINDOW(window), headerbar);
@@ -444,6 +3107,16 @@ public:
         GtkWidget *separator = gtk_separator_menu_item_new();
         gtk_menu_shell_append(GTK_MENU_SHELL(main_menu), separator);
         
+        // Nagrywanie wyjścia nowych zakładek
+        record_item = gtk_check_menu_item_new_with_label("Record Output of New Tabs");
+        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(record_item), config.record_output);
+        g_signal_connect(record_item, "toggled", G_CALLBACK(on_record_toggled), this);
+        g_signal_connect(main_menu, "show", G_CALLBACK(on_main_menu_show), this);
+        gtk_menu_shell_append(GTK_MENU_SHELL(main_menu), record_item);
+        
+        separator = gtk_separator_menu_item_new();
+        gtk_menu_shell_append(GTK_MENU_SHELL(main_menu), separator);
+        
         // Opcja motywów
         GtkWidget *theme_item = gtk_menu_item_new_with_label("Select Theme");
         g_signal_connect(theme_item, "activate", G_CALLBACK(on_theme_clicked), this);
@@ -491,10 +3164,16 @@ public:
         gtk_widget_show_all(main_menu);
         gtk_menu_button_set_popup(GTK_MENU_BUTTON(menu_button), main_menu);
         
+        StartupProfiler::record("headerbar and menu construction", menus_start, g_get_monotonic_time());
+        
         // Tworzenie głównego kontenera
         main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
         gtk_container_add(GTK_CONTAINER(window), main_box);
 
+        // Pasek wyszukiwania (ukryty, dopóki nie zostanie otwarty)
+        create_search_bar();
+        gtk_box_pack_start(GTK_BOX(main_box), search_bar, FALSE, FALSE, 0);
+
         // Tworzenie notebooka (zakładek)
         notebook = gtk_notebook_new();
         gtk_notebook_set_scrollable(GTK_NOTEBOOK(notebook), TRUE);
@@ -503,6 +3182,7 @@ public:
         
         // Sygnał zmiany zakładki
         g_signal_connect(notebook, "switch-page", G_CALLBACK(on_tab_switch), this);
+        g_signal_connect(notebook, "page-reordered", G_CALLBACK(on_page_reordered), this);
 
         // Inicjalizacja motywów kolorów
         initialize_color_themes();
@@ -514,54 +3194,556 @@ public:
             current_theme = &config.color_themes["Default"];
         }
 
-        // Dodanie pierwszej zakładki
-        add_new_tab();
-
-        // Wyświetlenie okna
-        gtk_widget_show_all(window);
-
-        // Uruchomienie głównej pętli GTK
-        gtk_main();
+        // Wspólny budżet pamięci na historię wszystkich zakładek we wszystkich oknach
+        if (scrollback_timeout_id == 0) {
+            scrollback_timeout_id = g_timeout_add_seconds(SCROLLBACK_CHECK_INTERVAL_S, on_scrollback_check, NULL);
+        }
+        
+        // Okresowy zapis sesji, żeby przetrwała także awarię procesu
+        if (session_timeout_id == 0) {
+            session_timeout_id = g_timeout_add_seconds(SESSION_SAVE_INTERVAL_S, on_session_save_timeout, NULL);
+        }
+        
+        if (windows.size() == 1) {
+            apply_process_monitor();
+        }
     }
 
+public:
     ~TerminalWindow() {
-        // Zapisanie konfiguracji przed zamknięciem
-        config.save_config();
+        // Ostatnie okno zapisuje sesję, zanim zakładki zostaną usunięte
+        if (windows.size() == 1) {
+            save_session();
+        }
+        
+        // Zapisanie konfiguracji przed zamknięciem - zapis i fsync kończy wątek
+        // zapisu, a na jego zakończenie czeka dopiero ~TerminalConfig
+        config.save_pending();
         
         for (auto tab : tabs) {
             delete tab;
         }
+        
+        // Zamknięcie ostatniego okna kończy proces
+        windows.erase(std::find(windows.begin(), windows.end(), this));
+        if (windows.empty()) {
+            if (scrollback_timeout_id != 0) {
+                g_source_remove(scrollback_timeout_id);
+                scrollback_timeout_id = 0;
+            }
+            if (session_timeout_id != 0) {
+                g_source_remove(session_timeout_id);
+                session_timeout_id = 0;
+            }
+            if (process_monitor_timeout_id != 0) {
+                g_source_remove(process_monitor_timeout_id);
+                process_monitor_timeout_id = 0;
+            }
+            gtk_main_quit();
+        }
     }
     
-    // Sprawdza, czy można bezpiecznie zamknąć okno
-    bool can_close_window() {
-        // Sprawdź, czy w którymkolwiek terminalu jest uruchomiony proces
-        for (auto tab : tabs) {
-            if (has_foreground_process(tab)) {
-                GtkWidget *dialog = gtk_message_dialog_new(
-                    GTK_WINDOW(window),
-                    GTK_DIALOG_MODAL,
-                    GTK_MESSAGE_QUESTION,
-                    GTK_BUTTONS_YES_NO,
-                    "There are processes running in terminal. Close anyway?");
+    void present() {
+        gtk_window_present(GTK_WINDOW(window));
+    }
+    
+    // Konfiguracja jest współdzielona, więc zmiany motywu obejmują wszystkie okna
+    static void apply_theme_to_all_terminals() {
+        for (auto win : windows) {
+            win->apply_render_path();
+            win->current_theme = &win->config.color_themes[win->config.current_theme_name];
+            for (auto tab : win->tabs) {
+                // Niezmaterializowane zakładki dostaną ustawienia przy materializacji
+                for (GtkWidget *terminal : tab->all_terminals()) {
+                    win->apply_theme_to_terminal(VTE_TERMINAL(terminal));
+                }
+            }
+        }
+    }
+    
+    static void apply_font_to_all_terminals() {
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                for (GtkWidget *terminal : tab->all_terminals()) {
+                    win->apply_font_to_terminal(VTE_TERMINAL(terminal));
+                }
+            }
+        }
+    }
+    
+    static void apply_scrollback_to_all_terminals() {
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                // Podgląd nagrania albo zapisanej historii ma nieograniczoną historię
+                if (tab->read_only) continue;
+                for (GtkWidget *terminal : tab->all_terminals()) {
+                    vte_terminal_set_scrollback_lines(VTE_TERMINAL(terminal), win->config.scrollback_lines);
+                }
+            }
+        }
+        enforce_scrollback_budget();
+    }
+    
+    // Pilnuje wspólnego budżetu historii (wszystkie terminale, także panele).
+    // Gdy szacowane zużycie go przekracza, historia terminali zakładek w tle
+    // jest przycinana od najdawniej oglądanej zakładki: każdy terminal traci
+    // tyle linii, ile trzeba (w razie potrzeby wszystkie), zanim przyjdzie
+    // kolej na następną zakładkę. Widoczne zakładki nie są przycinane.
+    static void enforce_scrollback_budget() {
+        if (windows.empty()) return;
+        
+        struct TerminalUsage {
+            TerminalTab *tab;
+            GtkWidget *terminal;
+            gint64 bytes;
+        };
+        
+        TerminalConfig &config = windows.front()->config;
+        std::vector<TerminalUsage> background;
+        gint64 total_bytes = 0;
+        gint64 background_bytes = 0;
+        
+        for (auto win : windows) {
+            TerminalTab *current = win->get_current_tab();
+            for (auto tab : win->tabs) {
+                // Przycięcie zniszczyłoby otwarte nagranie albo zapisaną historię
+                if (tab->read_only) continue;
+                for (GtkWidget *terminal : tab->all_terminals()) {
+                    gint64 bytes = estimate_scrollback_bytes(VTE_TERMINAL(terminal));
+                    total_bytes += bytes;
+                    if (tab != current) {
+                        background.push_back({tab, terminal, bytes});
+                        background_bytes += bytes;
+                    }
+                }
+            }
+        }
+        
+        gint64 budget_bytes = (gint64)config.scrollback_budget_mb * 1024 * 1024;
+        if (budget_bytes > 0 && total_bytes > budget_bytes && background_bytes > 0) {
+            std::stable_sort(background.begin(), background.end(), [](const TerminalUsage &a, const TerminalUsage &b) {
+                return a.tab->last_viewed < b.tab->last_viewed;
+            });
+            
+            for (const auto &usage : background) {
+                if (total_bytes <= budget_bytes) break;
                 
-                int response = gtk_dialog_run(GTK_DIALOG(dialog));
-                gtk_widget_destroy(dialog);
+                VteTerminal *terminal = VTE_TERMINAL(usage.terminal);
+                GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+                glong history = (glong)(gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment)) -
+                                vte_terminal_get_row_count(terminal);
+                if (history <= 0 || usage.bytes <= 0) continue;
                 
-                return (response == GTK_RESPONSE_YES);
+                // Linie do usunięcia według średniego rozmiaru linii tego terminala
+                double bytes_per_line = (double)usage.bytes / history;
+                glong drop_lines = (glong)std::ceil((total_bytes - budget_bytes) / bytes_per_line);
+                glong keep_lines = std::max(0L, history - drop_lines);
+                
+                // Zmniejszenie limitu usuwa najstarsze linie, przywrócenie pozwala historii znowu rosnąć
+                vte_terminal_set_scrollback_lines(terminal, keep_lines);
+                vte_terminal_set_scrollback_lines(terminal, config.scrollback_lines);
+                
+                gint64 trimmed_bytes = estimate_scrollback_bytes(terminal);
+                if (trimmed_bytes < usage.bytes) {
+                    total_bytes -= usage.bytes - trimmed_bytes;
+                    std::cerr << "Scrollback trimmed in tab " << usage.tab->title << " to " << keep_lines
+                              << " lines" << std::endl;
+                }
+            }
+        }
+        
+        // Aktualne zużycie widoczne w podtytule paska nagłówka
+        std::string usage_text;
+        if (budget_bytes > 0) {
+            gchar *text = g_strdup_printf("Scrollback %.1f of %d MB", total_bytes / (1024.0 * 1024.0),
+                                          config.scrollback_budget_mb);
+            usage_text = text;
+            g_free(text);
+        }
+        for (auto win : windows) {
+            gtk_header_bar_set_subtitle(GTK_HEADER_BAR(win->headerbar), usage_text.empty() ? NULL : usage_text.c_str());
+        }
+    }
+    
+    // Sprawdza, czy można bezpiecznie zamknąć okno
+    bool can_close_window() {
+        // Zbierz procesy ze wszystkich zakładek i zapytaj raz
+        std::vector<std::string> running;
+        for (size_t i = 0; i < tabs.size(); i++) {
+            for (const auto &command : get_running_commands(tabs[i])) {
+                running.push_back(command + " (tab " + std::to_string(i + 1) + ": " + tabs[i]->title + ")");
             }
         }
         
         // Jeśli nie ma aktywnych procesów, można bezpiecznie zamknąć
-        return true;
+        if (running.empty()) return true;
+        return confirm_close("There are processes running in terminal. Close anyway?", running);
     }
 
 private:
     GtkWidget *window;
     GtkWidget *main_box;
     GtkWidget *notebook;
+    GtkWidget *headerbar;
+    GtkWidget *record_item;
     std::vector<TerminalTab*> tabs;
-    TerminalConfig config;
+    TerminalConfig &config;
+    
+    // Przybliżony koszt jednej komórki historii (tekst i atrybuty) - VTE nie udostępnia zużycia pamięci
+    static constexpr gint64 SCROLLBACK_BYTES_PER_CELL = 8;
+    static constexpr guint SCROLLBACK_CHECK_INTERVAL_S = 5;
+    static inline guint scrollback_timeout_id = 0;
+    static constexpr glong SPILL_MIN_LINES = 1000;
+    guint materialize_idle_id;
+    
+    // Stan odtwarzania nagrania (tylko okno --replay)
+    struct ReplayState {
+        Asciicast::Recording recording;
+        TerminalTab *tab = nullptr;
+        bool fast = false;
+        size_t next_event = 0;
+        gint64 start_time = 0;
+        guint64 bytes = 0;
+        guint frames = 0;
+        bool finished = false;
+        guint source_id = 0;
+        GdkFrameClock *frame_clock = nullptr;
+        gulong paint_handler = 0;
+        
+        // Sterowanie powłoką zdarzeniami "i"
+        bool has_input = false;
+        guint64 input_bytes = 0;
+        gint64 last_output_time = 0;
+        
+        // Czasy rysowania terminala i odstępy między klatkami (w mikrosekundach)
+        GtkWidget *terminal = nullptr;
+        gulong draw_handler = 0;
+        gulong draw_after_handler = 0;
+        gulong contents_handler = 0;
+        gint64 draw_start = 0;
+        std::vector<gint64> draw_times;
+        gint64 last_frame_time = 0;
+        std::vector<gint64> frame_intervals;
+    };
+    ReplayState *replay = nullptr;
+    bool replay_window = false;
+    bool headless = false;
+    bool alpha_visual = false;
+    bool restoring_tabs = false;  // odtwarzanie sesji: przełączanie stron nie materializuje zakładek
+    std::vector<TerminalTab*> broadcast_tabs;         // kolejność dołączania
+    GtkWidget *broadcast_key_terminal = nullptr;      // terminal obsługujący właśnie klawisz
+    GtkIMContext *broadcast_im = nullptr;             // metoda wprowadzania dla terminali z grupy
+    GtkWidget *broadcast_im_terminal = nullptr;       // terminal, do którego podłączony jest broadcast_im
+    static inline bool broadcasting = false;
+    static constexpr gint64 BROADCAST_PASTE_TIMEOUT_US = 2 * G_USEC_PER_SEC;
+    GdkFrameClock *latency_frame_clock = nullptr;
+    static constexpr size_t REPLAY_BATCH_BYTES = 256 * 1024;
+    static constexpr guint REPLAY_SETTLE_MS = 300;
+    
+    // Podaje terminalowi kolejne zdarzenia: w trybie fast porcję na przebieg pętli
+    // (między porcjami GTK może narysować klatkę), w czasie rzeczywistym - zdarzenia,
+    // których czas już minął, i planuje się na czas następnego
+    static gboolean on_replay_step(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        ReplayState *replay = self->replay;
+        if (std::find(self->tabs.begin(), self->tabs.end(), replay->tab) == self->tabs.end()) {
+            // Zakładka odtwarzania została zamknięta
+            replay->source_id = 0;
+            self->stop_replay();
+            return G_SOURCE_REMOVE;
+        }
+        VteTerminal *terminal = VTE_TERMINAL(replay->tab->terminal);
+        const auto &events = replay->recording.events;
+        
+        gint64 elapsed = g_get_monotonic_time() - replay->start_time;
+        size_t batch_bytes = 0;
+        bool waiting = false;
+        while (replay->next_event < events.size()) {
+            const Asciicast::Event &event = events[replay->next_event];
+            // Wejście zawsze czeka na swój czas, także w trybie fast - powłoka
+            // potrzebuje nagranych przerw, żeby odpowiedzieć
+            bool timed = !replay->fast || event.type == 'i';
+            if (timed && event.time * G_USEC_PER_SEC > elapsed) {
+                waiting = true;
+                break;
+            }
+            if (replay->fast && batch_bytes >= REPLAY_BATCH_BYTES) {
+                break;
+            }
+            
+            if (event.type == 'i') {
+                // Pierwsze wejście może przyjść, zanim spawn powłoki podłączy PTY
+                feed_child_when_ready(replay->tab, terminal, event.data.data(), event.data.size());
+                replay->input_bytes += event.data.size();
+            } else if (event.type == 'o') {
+                vte_terminal_feed(terminal, event.data.data(), event.data.size());
+                replay->bytes += event.data.size();
+                batch_bytes += event.data.size();
+            } else if (event.type == 'r') {
+                glong columns = 0, rows = 0;
+                if (sscanf(event.data.c_str(), "%ldx%ld", &columns, &rows) == 2 && columns > 0 && rows > 0) {
+                    vte_terminal_set_size(terminal, columns, rows);
+                }
+            }
+            replay->next_event++;
+        }
+        
+        if (replay->next_event < events.size()) {
+            if (!waiting) {
+                replay->source_id = g_idle_add(on_replay_step, self);
+            } else {
+                gint64 delay = (gint64)(events[replay->next_event].time * G_USEC_PER_SEC) - elapsed;
+                replay->source_id = g_timeout_add(std::max<gint64>(delay / 1000, 0), on_replay_step, self);
+            }
+            return G_SOURCE_REMOVE;
+        }
+        
+        if (replay->has_input) {
+            // Powłoka może jeszcze odpowiadać na ostatnie wejście
+            replay->source_id = g_timeout_add(REPLAY_SETTLE_MS, on_replay_settle, self);
+            return G_SOURCE_REMOVE;
+        }
+        
+        self->finish_replay();
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Raport powstaje po następnej klatce, gdy ostatnie dane są już narysowane
+    void finish_replay() {
+        replay->finished = true;
+        replay->source_id = 0;
+        gtk_widget_queue_draw(replay->terminal);
+    }
+    
+    // Kończy odtwarzanie, gdy powłoka przez REPLAY_SETTLE_MS nic nie wypisała
+    static gboolean on_replay_settle(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        ReplayState *replay = self->replay;
+        gint64 quiet_ms = (g_get_monotonic_time() - replay->last_output_time) / 1000;
+        if (quiet_ms < REPLAY_SETTLE_MS) {
+            replay->source_id = g_timeout_add(REPLAY_SETTLE_MS - quiet_ms, on_replay_settle, self);
+            return G_SOURCE_REMOVE;
+        }
+        self->finish_replay();
+        return G_SOURCE_REMOVE;
+    }
+    
+    static void on_replay_contents_changed(VteTerminal *terminal, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->replay->last_output_time = g_get_monotonic_time();
+    }
+    
+    static gboolean on_replay_draw_start(GtkWidget *widget, cairo_t *cr, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->replay->draw_start = g_get_monotonic_time();
+        return FALSE;
+    }
+    
+    static gboolean on_replay_draw_end(GtkWidget *widget, cairo_t *cr, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        ReplayState *replay = self->replay;
+        if (replay->draw_start != 0) {
+            replay->draw_times.push_back(g_get_monotonic_time() - replay->draw_start);
+            replay->draw_start = 0;
+        }
+        return FALSE;
+    }
+    
+    // Percentyl w milisekundach; values są sortowane w miejscu
+    static double replay_percentile_ms(std::vector<gint64> &values, double percentile) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        size_t index = std::min(values.size() - 1, (size_t)(percentile / 100.0 * values.size()));
+        return values[index] / 1000.0;
+    }
+    
+    static void on_replay_frame(GdkFrameClock *frame_clock, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        ReplayState *replay = self->replay;
+        replay->frames++;
+        gint64 now = g_get_monotonic_time();
+        if (replay->last_frame_time != 0) {
+            replay->frame_intervals.push_back(now - replay->last_frame_time);
+        }
+        replay->last_frame_time = now;
+        if (!replay->finished) return;
+        
+        double seconds = (now - replay->start_time) / (double)G_USEC_PER_SEC;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        g_print("Replay: %llu bytes in %.3f s (%.1f MB/s), %u frames, peak RSS %.1f MB\n",
+                (unsigned long long)replay->bytes, seconds, replay->bytes / seconds / (1024 * 1024), replay->frames,
+                usage.ru_maxrss / 1024.0);
+        
+        size_t draws = replay->draw_times.size();
+        gint64 draw_max = draws ? *std::max_element(replay->draw_times.begin(), replay->draw_times.end()) : 0;
+        g_print("Replay timing: %zu draws, draw p50 %.2f ms, p95 %.2f ms, max %.2f ms, frame interval p50 %.2f ms, p95 %.2f ms, "
+                "%s render path\n",
+                draws, replay_percentile_ms(replay->draw_times, 50), replay_percentile_ms(replay->draw_times, 95),
+                draw_max / 1000.0, replay_percentile_ms(replay->frame_intervals, 50),
+                replay_percentile_ms(replay->frame_intervals, 95), self->alpha_visual ? "alpha" : "opaque");
+        if (replay->has_input) {
+            g_print("Replay input: %llu bytes sent to the shell\n", (unsigned long long)replay->input_bytes);
+        }
+        
+        bool close = replay->fast || self->headless;
+        self->stop_replay();
+        if (close) {
+            gtk_widget_destroy(self->window);
+        }
+    }
+    
+    // Okno realizowane od nowa (apply_render_path) dostaje nowy zegar klatek
+    void connect_replay_frame_clock() {
+        if (replay->frame_clock) {
+            g_signal_handler_disconnect(replay->frame_clock, replay->paint_handler);
+            g_object_unref(replay->frame_clock);
+            replay->frame_clock = nullptr;
+        }
+        GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(window);
+        if (frame_clock) {
+            replay->frame_clock = GDK_FRAME_CLOCK(g_object_ref(frame_clock));
+            replay->paint_handler = g_signal_connect(frame_clock, "after-paint", G_CALLBACK(on_replay_frame), this);
+        }
+    }
+    
+    void stop_replay() {
+        if (!replay) return;
+        if (replay->source_id != 0) {
+            g_source_remove(replay->source_id);
+        }
+        if (replay->frame_clock) {
+            g_signal_handler_disconnect(replay->frame_clock, replay->paint_handler);
+            g_object_unref(replay->frame_clock);
+        }
+        // Referencja trzyma terminal przy życiu, więc odłączenie jest bezpieczne
+        // także po zamknięciu zakładki
+        g_signal_handler_disconnect(replay->terminal, replay->draw_handler);
+        g_signal_handler_disconnect(replay->terminal, replay->draw_after_handler);
+        if (replay->contents_handler != 0) {
+            g_signal_handler_disconnect(replay->terminal, replay->contents_handler);
+        }
+        g_object_unref(replay->terminal);
+        delete replay;
+        replay = nullptr;
+    }
+    
+    static constexpr guint SESSION_SAVE_INTERVAL_S = 30;
+    static inline guint session_timeout_id = 0;
+    static inline guint process_monitor_timeout_id = 0;
+    static inline PangoFontDescription *font_description = nullptr;
+    static inline std::string font_description_family;
+    static inline double font_description_size = 0;
+    static inline std::string last_saved_session;
+    
+    static gboolean on_session_save_timeout(gpointer data) {
+        save_session();
+        return G_SOURCE_CONTINUE;
+    }
+    
+    SessionStore::Window snapshot() {
+        SessionStore::Window session;
+        session.current_page = std::max(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)), 0);
+        for (auto tab : tabs) {
+            if (tab->read_only) continue;
+            session.tabs.push_back({tab->title, get_tab_working_directory(tab)});
+        }
+        return session;
+    }
+    
+    // Bieżący katalog powłoki; zakładka bez procesu zachowuje katalog startowy
+    static std::string get_tab_working_directory(TerminalTab *tab) {
+        return get_process_directory(tab->child_pid, tab->working_directory);
+    }
+    
+    static std::string get_process_directory(GPid pid, const std::string &fallback) {
+        if (pid > 0) {
+            std::string link = "/proc/" + std::to_string(pid) + "/cwd";
+            char buffer[PATH_MAX];
+            ssize_t length = readlink(link.c_str(), buffer, sizeof(buffer) - 1);
+            if (length > 0) {
+                return std::string(buffer, length);
+            }
+        }
+        return fallback;
+    }
+    
+    static gint64 estimate_scrollback_bytes(VteTerminal *terminal) {
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        double lines = gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment);
+        return (gint64)lines * vte_terminal_get_column_count(terminal) * SCROLLBACK_BYTES_PER_CELL;
+    }
+    
+    static gboolean on_scrollback_check(gpointer data) {
+        spill_idle_scrollback();
+        enforce_scrollback_budget();
+        return G_SOURCE_CONTINUE;
+    }
+    
+    // Zrzuca na dysk historię zakładek nieoglądanych dłużej niż scrollback_spill_minutes.
+    // Ponowny zrzut następuje dopiero, gdy nazbiera się SPILL_MIN_LINES nowych linii.
+    static void spill_idle_scrollback() {
+        if (windows.empty() || windows.front()->config.scrollback_spill_minutes <= 0) return;
+        
+        TerminalConfig &config = windows.front()->config;
+        gint64 idle_limit = (gint64)config.scrollback_spill_minutes * 60 * G_USEC_PER_SEC;
+        gint64 now = g_get_monotonic_time();
+        
+        for (auto win : windows) {
+            TerminalTab *current = win->get_current_tab();
+            for (auto tab : win->tabs) {
+                if (!tab->terminal || tab->read_only || tab == current) continue;
+                if (now - tab->last_viewed < idle_limit) continue;
+                
+                VteTerminal *terminal = VTE_TERMINAL(tab->terminal);
+                if (get_history_lines(terminal) < SPILL_MIN_LINES) continue;
+                
+                std::string path = ScrollbackSpill::new_spill_path();
+                if (!ScrollbackSpill::write(terminal, path)) continue;
+                
+                tab->spill_files.push_back(path);
+                vte_terminal_set_scrollback_lines(terminal, 0);
+                vte_terminal_set_scrollback_lines(terminal, config.scrollback_lines);
+                std::cerr << "Scrollback of tab " << tab->title << " moved to " << path << std::endl;
+            }
+        }
+    }
+    
+    // Liczba linii historii ponad widoczny ekran
+    static glong get_history_lines(VteTerminal *terminal) {
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        double lines = gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment);
+        return (glong)lines - vte_terminal_get_row_count(terminal);
+    }
+    
+    // Wyszukiwanie we wszystkich zakładkach i panel wyników
+    enum { HIT_COLUMN_TAB, HIT_COLUMN_LINE, HIT_COLUMN_CONTEXT, HIT_COLUMN_INDEX, HIT_N_COLUMNS };
+    GtkWidget *search_panel = nullptr;
+    GtkWidget *search_status = nullptr;
+    GtkListStore *search_store = nullptr;
+    TabSearch *tab_search = nullptr;
+    std::vector<TabSearch::Hit> search_hits;
+    std::deque<unsigned> search_pending;   // identyfikatory zakładek czekających na snapshot
+    std::set<unsigned> search_hit_tabs;
+    guint search_snapshot_id = 0;
+    guint search_poll_id = 0;
+    
+    // Pasek wyszukiwania w bieżącej zakładce
+    GtkWidget *search_bar = nullptr;
+    GtkWidget *search_entry = nullptr;
+    GtkWidget *search_regex_check = nullptr;
+    GtkWidget *search_case_check = nullptr;
+    GtkWidget *search_count_label = nullptr;
+    MatchCounter *match_counter = nullptr;
+    unsigned count_generation = 0;
+    guint count_delay_id = 0;
+    guint count_poll_id = 0;
+    // Tekst terminala do liczenia, ważny do najbliższej zmiany jego zawartości
+    std::shared_ptr<const std::string> count_text;
+    GtkWidget *count_text_terminal = nullptr;
+    static constexpr guint SEARCH_POLL_MS = 100;
+    static constexpr guint SEARCH_COUNT_DELAY_MS = 150;
+    
     ColorTheme *current_theme;
     
     // Inicjalizacja palety kolorów, jeśli jest pusta
@@ -677,70 +3859,508 @@ private:
             apply_theme_to_all_terminals();
             
             // Zapisz konfigurację po zmianie
-            config.save_config();
+            config.mark_settings_dirty();
+        }
+        
+        gtk_widget_destroy(dialog);
+    }
+
+    // Leniwa zakładka (lazy) dostaje tylko stronę i etykietę - widget terminala
+    // i powłoka powstają dopiero w materialize_tab. Zakładka read_only nie ma powłoki.
+    TerminalTab *add_new_tab(const std::string &title = "Terminal", const std::string &working_directory = "",
+                             bool lazy = false, bool read_only = false) {
+        g_print("Tworzenie nowej zakładki...\n");
+        
+        // Strona notebooka, do której trafi terminal
+        GtkWidget *page = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+        gtk_widget_show(page);
+        
+        // Tworzenie etykiety zakładki
+        GtkWidget *tab_container = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+        GtkWidget *broadcast_icon = gtk_image_new_from_icon_name("network-transmit-receive-symbolic", GTK_ICON_SIZE_MENU);
+        gtk_widget_set_tooltip_text(broadcast_icon, "Receiving broadcast input");
+        gtk_widget_set_no_show_all(broadcast_icon, TRUE);
+        gtk_box_pack_start(GTK_BOX(tab_container), broadcast_icon, FALSE, FALSE, 0);
+        GtkWidget *label = gtk_label_new(title.c_str());
+        gtk_box_pack_start(GTK_BOX(tab_container), label, TRUE, TRUE, 0);
+        
+        // Przycisk zamykania
+        GtkWidget *close_button = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_MENU);
+        gtk_button_set_relief(GTK_BUTTON(close_button), GTK_RELIEF_NONE);
+        gtk_box_pack_start(GTK_BOX(tab_container), close_button, FALSE, FALSE, 0);
+        gtk_widget_show_all(tab_container);
+        
+        // Tworzenie obiektu TerminalTab - przed dodaniem strony, bo pierwsza strona
+        // od razu wywołuje switch-page
+        TerminalTab *tab = new TerminalTab(GTK_NOTEBOOK(notebook), title);
+        tab->page = page;
+        tab->label = label;
+        tab->tab_container = tab_container;
+        tab->close_button = close_button;
+        tab->broadcast_icon = broadcast_icon;
+        tab->working_directory = working_directory;
+        tab->read_only = read_only;
+        tabs.push_back(tab);
+        
+        g_signal_connect(close_button, "clicked", G_CALLBACK(on_tab_close_clicked), this);
+        
+        // Dodanie zakładki do notebooka
+        int index = gtk_notebook_append_page(GTK_NOTEBOOK(notebook), page, tab_container);
+        gtk_notebook_set_tab_reorderable(GTK_NOTEBOOK(notebook), page, TRUE);
+        
+        // Pokaż pasek zakładek, jeśli jest więcej niż jedna karta
+        if (tabs.size() > 1) {
+            gtk_notebook_set_show_tabs(GTK_NOTEBOOK(notebook), TRUE);
+        }
+        
+        if (lazy) {
+            g_print("Zakładka zadeklarowana, indeks: %d\n", index);
+            return tab;
+        }
+        
+        materialize_tab(tab);
+        
+        // Przełączenie na nową zakładkę
+        gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), index);
+        gtk_widget_grab_focus(tab->terminal);
+        
+        g_print("Zakładka utworzona, indeks: %d\n", index);
+        return tab;
+    }
+    
+    // Tworzy terminal zakładki i uruchamia w nim powłokę (tylko raz)
+    void materialize_tab(TerminalTab *tab) {
+        if (tab->terminal) return;
+        
+        GtkWidget *terminal = create_terminal_widget(tab);
+        tab->terminal = terminal;
+        gtk_box_pack_start(GTK_BOX(tab->page), terminal, TRUE, TRUE, 0);
+        gtk_widget_show(terminal);
+        
+        // Pomiar opóźnienia: własna obsługa key-press-event działa przed obsługą VTE
+        if (config.latency_probe && !tab->read_only) {
+            tab->latency = new LatencyProbe();
+            g_signal_connect(terminal, "key-press-event", G_CALLBACK(on_terminal_key_latency), tab);
+            g_signal_connect(terminal, "contents-changed", G_CALLBACK(on_contents_changed_latency), tab);
+        }
+        
+        // Uruchomienie powłoki - podgląd historii jej nie ma
+        if (tab->read_only) {
+            vte_terminal_set_input_enabled(VTE_TERMINAL(terminal), FALSE);
+            vte_terminal_set_scrollback_lines(VTE_TERMINAL(terminal), -1);
+        } else if (config.record_output) {
+            spawn_recorded_shell(tab);
+        } else {
+            spawn_shell(VTE_TERMINAL(terminal), &tab->child_pid, tab->working_directory, tab->command);
+        }
+    }
+    
+    // Nowy terminal zakładki (główny albo panel) z sygnałami, czcionką i motywem
+    GtkWidget *create_terminal_widget(TerminalTab *tab) {
+        GtkWidget *terminal = vte_terminal_new();
+        
+        // Sygnały dla terminala
+        g_signal_connect(terminal, "button-press-event", G_CALLBACK(on_right_click), this);
+        g_signal_connect(terminal, "child-exited", G_CALLBACK(on_terminal_exit), this);
+        g_signal_connect(terminal, "window-title-changed", G_CALLBACK(on_title_changed), tab);
+        g_signal_connect(terminal, "focus-in-event", G_CALLBACK(on_terminal_focus_in), tab);
+        g_signal_connect(terminal, "key-press-event", G_CALLBACK(on_broadcast_key_press), this);
+        g_signal_connect(terminal, "key-release-event", G_CALLBACK(on_broadcast_key_release), this);
+        g_signal_connect(terminal, "event-after", G_CALLBACK(on_broadcast_event_after), this);
+        g_signal_connect(terminal, "commit", G_CALLBACK(on_broadcast_commit), this);
+        
+        // Ustawienie czcionki i limitu historii z konfiguracji
+        apply_font_to_terminal(VTE_TERMINAL(terminal));
+        vte_terminal_set_scrollback_lines(VTE_TERMINAL(terminal), config.scrollback_lines);
+        
+        // Zastosowanie aktualnego motywu
+        apply_theme_to_terminal(VTE_TERMINAL(terminal));
+        return terminal;
+    }
+    
+    // Dzieli aktywny terminal bieżącej zakładki. GTK_ORIENTATION_HORIZONTAL
+    // stawia nowy panel obok, GTK_ORIENTATION_VERTICAL pod spodem.
+    void split_active_pane(GtkOrientation orientation) {
+        TerminalTab *tab = get_current_tab();
+        if (!tab || !tab->terminal || tab->read_only) return;
+        
+        GtkWidget *current = tab->active_terminal();
+        GtkWidget *parent = gtk_widget_get_parent(current);
+        int size = orientation == GTK_ORIENTATION_HORIZONTAL ? gtk_widget_get_allocated_width(current)
+                                                             : gtk_widget_get_allocated_height(current);
+        
+        // Nowa powłoka startuje w katalogu aktywnego panelu
+        std::string directory = get_process_directory(get_terminal_pid(tab, current), tab->working_directory);
+        
+        TerminalPane *pane = new TerminalPane();
+        pane->terminal = create_terminal_widget(tab);
+        tab->panes.push_back(pane);
+        
+        GtkWidget *paned = gtk_paned_new(orientation);
+        g_object_ref(current);
+        replace_child(parent, current, paned);
+        gtk_paned_pack1(GTK_PANED(paned), current, TRUE, FALSE);
+        gtk_paned_pack2(GTK_PANED(paned), pane->terminal, TRUE, FALSE);
+        g_object_unref(current);
+        gtk_paned_set_position(GTK_PANED(paned), size / 2);
+        gtk_widget_show_all(paned);
+        
+        spawn_shell(VTE_TERMINAL(pane->terminal), &pane->child_pid, directory);
+        gtk_widget_grab_focus(pane->terminal);
+    }
+    
+    // Wstawia replacement w miejsce child (strona zakładki albo jedna ze stron GtkPaned)
+    static void replace_child(GtkWidget *parent, GtkWidget *child, GtkWidget *replacement) {
+        if (GTK_IS_PANED(parent)) {
+            bool first = gtk_paned_get_child1(GTK_PANED(parent)) == child;
+            gtk_container_remove(GTK_CONTAINER(parent), child);
+            if (first) {
+                gtk_paned_pack1(GTK_PANED(parent), replacement, TRUE, FALSE);
+            } else {
+                gtk_paned_pack2(GTK_PANED(parent), replacement, TRUE, FALSE);
+            }
+        } else {
+            gtk_container_remove(GTK_CONTAINER(parent), child);
+            gtk_box_pack_start(GTK_BOX(parent), replacement, TRUE, TRUE, 0);
+        }
+    }
+    
+    // Rozgłaszanie wejścia: klawisze i wklejenia w terminalu zakładki z grupy
+    // trafiają przez vte_terminal_feed_child do pozostałych zakładek grupy
+    // (do ich aktywnych paneli). Grupa jest osobna dla każdego okna.
+    void set_broadcast(TerminalTab *tab, bool enabled) {
+        if (tab->broadcast == enabled || (enabled && tab->read_only)) return;
+        
+        if (enabled) {
+            materialize_tab(tab);
+            broadcast_tabs.push_back(tab);
+        } else {
+            broadcast_tabs.erase(std::find(broadcast_tabs.begin(), broadcast_tabs.end(), tab));
+        }
+        tab->broadcast = enabled;
+        gtk_widget_set_visible(tab->broadcast_icon, enabled);
+    }
+    
+    void set_broadcast_all(bool enabled) {
+        for (auto tab : tabs) {
+            set_broadcast(tab, enabled);
+        }
+    }
+    
+    void forget_broadcast_source(GtkWidget *terminal) {
+        if (broadcast_key_terminal == terminal) broadcast_key_terminal = nullptr;
+        if (broadcast_im_terminal == terminal) {
+            gtk_im_context_focus_out(broadcast_im);
+            gtk_im_context_set_client_window(broadcast_im, NULL);
+            broadcast_im_terminal = nullptr;
+        }
+    }
+    
+    // Zakładka terminala, jeśli należy do grupy rozgłaszania z co najmniej dwiema zakładkami
+    TerminalTab *broadcast_source(GtkWidget *terminal) {
+        if (broadcast_tabs.size() < 2) return nullptr;
+        for (auto tab : broadcast_tabs) {
+            if (tab->owns_terminal(terminal)) return tab;
+        }
+        return nullptr;
+    }
+    
+    // Ten sam bufor trafia do każdej zakładki - bez kopii na zakładkę.
+    // feed_child emituje commit w terminalu docelowym - bez ponownego rozgłaszania.
+    void broadcast_input(TerminalTab *source, const char *text, gsize size) {
+        broadcasting = true;
+        for (auto tab : broadcast_tabs) {
+            if (tab != source) {
+                vte_terminal_feed_child(VTE_TERMINAL(tab->active_terminal()), text, size);
+            }
+        }
+        broadcasting = false;
+    }
+    
+    // Przez "commit" przechodzą też odpowiedzi terminala na zapytania programów
+    // (np. pozycja kursora), które nie mogą trafić do innych zakładek. Dlatego
+    // commit VTE jest rozgłaszany tylko podczas obsługi klawisza bez tekstu
+    // (strzałki, Enter, Ctrl+C - VTE koduje je synchronicznie). Tekst z metody
+    // wprowadzania, także asynchronicznej, przychodzi przez commit własnego
+    // broadcast_im (on_broadcast_im_commit), a wklejany tekst przez on_paste_text.
+    static gboolean on_broadcast_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        if (!self->broadcast_source(widget)) return FALSE;
+        
+        // Shift+Insert wkleja zaznaczenie, Ctrl+Shift+Insert schowek - jak w VTE
+        if (event->keyval == GDK_KEY_Insert && (event->state & GDK_SHIFT_MASK)) {
+            self->paste_selection(widget, (event->state & GDK_CONTROL_MASK) ? GDK_SELECTION_CLIPBOARD
+                                                                            : GDK_SELECTION_PRIMARY);
+            return TRUE;
+        }
+        
+        self->attach_broadcast_im(widget);
+        if (gtk_im_context_filter_keypress(self->broadcast_im, event)) {
+            return TRUE;
+        }
+        self->broadcast_key_terminal = widget;
+        return FALSE;
+    }
+    
+    // Część metod wprowadzania (np. IBus) potrzebuje także zwolnień klawiszy
+    static gboolean on_broadcast_key_release(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        if (widget != self->broadcast_im_terminal || !self->broadcast_source(widget)) return FALSE;
+        return gtk_im_context_filter_keypress(self->broadcast_im, event);
+    }
+    
+    // Podgląd edycji (preedit) metoda wprowadzania pokazuje we własnym oknie,
+    // bo tekst trafia do terminali dopiero po zatwierdzeniu
+    void attach_broadcast_im(GtkWidget *terminal) {
+        if (!broadcast_im) {
+            broadcast_im = gtk_im_multicontext_new();
+            gtk_im_context_set_use_preedit(broadcast_im, FALSE);
+            g_signal_connect(broadcast_im, "commit", G_CALLBACK(on_broadcast_im_commit), this);
+        }
+        if (broadcast_im_terminal == terminal) return;
+        
+        if (broadcast_im_terminal) {
+            gtk_im_context_focus_out(broadcast_im);
+        }
+        gtk_im_context_set_client_window(broadcast_im, gtk_widget_get_window(terminal));
+        gtk_im_context_focus_in(broadcast_im);
+        broadcast_im_terminal = terminal;
+    }
+    
+    static void on_broadcast_im_commit(GtkIMContext *context, gchar *text, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        GtkWidget *terminal = self->broadcast_im_terminal;
+        if (!terminal) return;
+        
+        gsize size = strlen(text);
+        broadcasting = true;
+        vte_terminal_feed_child(VTE_TERMINAL(terminal), text, size);
+        broadcasting = false;
+        
+        // Zakładka mogła opuścić grupę przed zatwierdzeniem tekstu
+        TerminalTab *source = self->broadcast_source(terminal);
+        if (source) {
+            self->broadcast_input(source, text, size);
+        }
+    }
+    
+    // event-after przychodzi także wtedy, gdy VTE obsłużył klawisz
+    static void on_broadcast_event_after(GtkWidget *widget, GdkEvent *event, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        if (self->broadcast_key_terminal == widget) {
+            self->broadcast_key_terminal = nullptr;
         }
-        
-        gtk_widget_destroy(dialog);
     }
-
-    void add_new_tab(const std::string &title = "Terminal") {
-        g_print("Tworzenie nowej zakładki...\n");
-        
-        // Tworzenie nowego terminala
-        GtkWidget *terminal = vte_terminal_new();
-        gtk_widget_show(terminal);
-        
-        // Tworzenie etykiety zakładki
-        GtkWidget *tab_container = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
-        GtkWidget *label = gtk_label_new(title.c_str());
-        gtk_box_pack_start(GTK_BOX(tab_container), label, TRUE, TRUE, 0);
-        
-        // Przycisk zamykania
-        GtkWidget *close_button = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_MENU);
-        gtk_button_set_relief(GTK_BUTTON(close_button), GTK_RELIEF_NONE);
-        gtk_box_pack_start(GTK_BOX(tab_container), close_button, FALSE, FALSE, 0);
-        gtk_widget_show_all(tab_container);
-        
-        // Dodanie zakładki do notebooka
-        int index = gtk_notebook_append_page(GTK_NOTEBOOK(notebook), terminal, tab_container);
-        gtk_notebook_set_tab_reorderable(GTK_NOTEBOOK(notebook), terminal, TRUE);
+    
+    static void on_broadcast_commit(VteTerminal *terminal, gchar *text, guint size, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        GtkWidget *widget = GTK_WIDGET(terminal);
+        if (broadcasting) return;
+        if (widget != self->broadcast_key_terminal) return;
         
-        // Tworzenie obiektu TerminalTab
-        TerminalTab *tab = new TerminalTab(GTK_NOTEBOOK(notebook), title);
-        tab->terminal = terminal;
-        tab->label = label;
-        tab->tab_container = tab_container;
-        tab->close_button = close_button;
-        tabs.push_back(tab);
+        TerminalTab *source = self->broadcast_source(widget);
+        if (source) {
+            self->broadcast_input(source, text, size);
+        }
+    }
+    
+    // Wklejanie z żądaniem schowka po stronie okna. Każdy terminal grupy
+    // dostaje surowy tekst schowka i koduje go sam (bracketed paste, znaki
+    // nowej linii) według trybu swojego programu. Pusty schowek nic nie
+    // wkleja, a odpowiedź spóźniona o ponad BROADCAST_PASTE_TIMEOUT_US trafia
+    // już tylko do terminala, w którym wklejano.
+    struct PasteRequest {
+        TerminalWindow *window;
+        GtkWidget *terminal;
+        gint64 deadline;
+    };
+    
+    void paste_selection(GtkWidget *terminal, GdkAtom selection) {
+        PasteRequest *request = new PasteRequest{this, GTK_WIDGET(g_object_ref(terminal)),
+                                                 g_get_monotonic_time() + BROADCAST_PASTE_TIMEOUT_US};
+        gtk_clipboard_request_text(gtk_widget_get_clipboard(terminal, selection), on_paste_text, request);
+    }
+    
+    static void on_paste_text(GtkClipboard *clipboard, const gchar *text, gpointer data) {
+        PasteRequest *request = static_cast<PasteRequest*>(data);
+        TerminalWindow *self = request->window;
+        GtkWidget *terminal = request->terminal;
+        
+        // Okno albo terminal mogły zostać zamknięte w trakcie żądania
+        bool alive = std::find(windows.begin(), windows.end(), self) != windows.end() &&
+                     std::any_of(self->tabs.begin(), self->tabs.end(),
+                                 [terminal](TerminalTab *tab) { return tab->owns_terminal(terminal); });
+        if (alive && text) {
+            TerminalTab *source = g_get_monotonic_time() <= request->deadline ? self->broadcast_source(terminal) : nullptr;
+            
+            // Commit wklejania nie jest rozgłaszany - cele wklejają tekst same
+            broadcasting = true;
+            paste_into(terminal, text);
+            if (source) {
+                for (auto tab : self->broadcast_tabs) {
+                    if (tab != source) {
+                        paste_into(tab->active_terminal(), text);
+                    }
+                }
+            }
+            broadcasting = false;
+        }
         
-        // Sygnały dla terminala
-        g_signal_connect(terminal, "button-press-event", G_CALLBACK(on_right_click), this);
-        g_signal_connect(terminal, "child-exited", G_CALLBACK(on_terminal_exit), this);
-        g_signal_connect(terminal, "window-title-changed", G_CALLBACK(on_title_changed), tab);
-        g_signal_connect(close_button, "clicked", G_CALLBACK(on_tab_close_clicked), this);
+        g_object_unref(terminal);
+        delete request;
+    }
+    
+    static void paste_into(GtkWidget *terminal, const gchar *text) {
+#if VTE_CHECK_VERSION(0, 68, 0)
+        vte_terminal_paste_text(VTE_TERMINAL(terminal), text);
+#else
+        vte_terminal_feed_child(VTE_TERMINAL(terminal), text, strlen(text));
+#endif
+    }
+    
+    // Zamyka jeden terminal zakładki; sąsiedni panel zajmuje jego miejsce.
+    // Ostatni terminal zamyka całą zakładkę (close_tab).
+    void close_pane(TerminalTab *tab, GtkWidget *terminal, bool confirm) {
+        auto it = std::find(tabs.begin(), tabs.end(), tab);
+        if (it == tabs.end()) return;
+        if (tab->panes.empty()) {
+            close_tab(it - tabs.begin());
+            return;
+        }
         
-        // Ustawienie czcionki z konfiguracji
-        PangoFontDescription *font_desc = pango_font_description_from_string(config.font_family.c_str());
-        pango_font_description_set_size(font_desc, (int)(config.font_size * PANGO_SCALE));
-        vte_terminal_set_font(VTE_TERMINAL(terminal), font_desc);
-        pango_font_description_free(font_desc);
+        bool was_active = tab->active_terminal() == terminal;
+        if (confirm) {
+            std::string command = get_foreground_command(tab, terminal);
+            if (!command.empty() &&
+                !confirm_close("There is a process running in this terminal. Close anyway?", {command})) {
+                return;
+            }
+        }
         
-        // Zastosowanie aktualnego motywu
-        apply_theme_to_terminal(VTE_TERMINAL(terminal));
+        if (terminal == tab->terminal) {
+            // Pierwszy panel przejmuje rolę głównego terminala zakładki
+            TerminalPane *successor = tab->panes.front();
+            tab->release_terminal();
+            tab->terminal = successor->terminal;
+            tab->child_pid = successor->child_pid;
+            tab->panes.erase(tab->panes.begin());
+            delete successor;
+        } else {
+            auto pane = std::find_if(tab->panes.begin(), tab->panes.end(),
+                                     [terminal](TerminalPane *pane) { return pane->terminal == terminal; });
+            if (pane == tab->panes.end()) return;
+            if ((*pane)->child_pid > 0) {
+                kill((*pane)->child_pid, SIGTERM);
+            }
+            delete *pane;
+            tab->panes.erase(pane);
+        }
         
-        // Uruchomienie powłoki
-        spawn_shell(VTE_TERMINAL(terminal), &tab->child_pid);
+        // Rodzeństwo zamykanego terminala zajmuje miejsce jego GtkPaned
+        GtkWidget *paned = gtk_widget_get_parent(terminal);
+        GtkWidget *sibling = gtk_paned_get_child1(GTK_PANED(paned)) == terminal ? gtk_paned_get_child2(GTK_PANED(paned))
+                                                                                 : gtk_paned_get_child1(GTK_PANED(paned));
+        tab->pending_input.erase(terminal);
+        g_signal_handlers_disconnect_by_data(terminal, this);
+        g_signal_handlers_disconnect_by_data(terminal, tab);
+        forget_broadcast_source(terminal);
+        g_object_ref(sibling);
+        gtk_container_remove(GTK_CONTAINER(paned), sibling);
+        replace_child(gtk_widget_get_parent(paned), paned, sibling);
+        g_object_unref(sibling);
+        
+        // Fokus przechodzi do pierwszego terminala w miejscu zamkniętego
+        if (was_active) {
+            while (GTK_IS_PANED(sibling)) {
+                sibling = gtk_paned_get_child1(GTK_PANED(sibling));
+            }
+            tab->focused_terminal = sibling;
+            gtk_widget_grab_focus(sibling);
+        }
+    }
+    
+    void close_active_pane() {
+        TerminalTab *tab = get_current_tab();
+        if (!tab) return;
+        if (tab->terminal) {
+            close_pane(tab, tab->active_terminal(), true);
+        } else {
+            close_tab(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+        }
+    }
+    
+    // Przenosi fokus do najbliższego panelu w kierunku (dx, dy); bez panelu
+    // w tym kierunku zwraca false, żeby klawisz trafił do powłoki
+    bool focus_pane(int dx, int dy) {
+        TerminalTab *tab = get_current_tab();
+        if (!tab || tab->panes.empty()) return false;
+        
+        GtkWidget *current = tab->active_terminal();
+        int current_x, current_y;
+        gtk_widget_translate_coordinates(current, tab->page, gtk_widget_get_allocated_width(current) / 2,
+                                         gtk_widget_get_allocated_height(current) / 2, &current_x, &current_y);
+        
+        GtkWidget *best = nullptr;
+        int best_distance = G_MAXINT;
+        for (GtkWidget *terminal : tab->all_terminals()) {
+            if (terminal == current) continue;
+            int x, y;
+            gtk_widget_translate_coordinates(terminal, tab->page, gtk_widget_get_allocated_width(terminal) / 2,
+                                             gtk_widget_get_allocated_height(terminal) / 2, &x, &y);
+            
+            // Tylko panele leżące po właściwej stronie; odchylenie w bok liczy się podwójnie
+            int along = (x - current_x) * dx + (y - current_y) * dy;
+            if (along <= 0) continue;
+            int across = std::abs(dx != 0 ? y - current_y : x - current_x);
+            int distance = along + 2 * across;
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = terminal;
+            }
+        }
+        if (!best) return false;
+        gtk_widget_grab_focus(best);
+        return true;
+    }
+    
+    // Pid powłoki działającej w danym terminalu zakładki
+    static GPid get_terminal_pid(TerminalTab *tab, GtkWidget *terminal) {
+        if (terminal == tab->terminal) return tab->child_pid;
+        for (auto pane : tab->panes) {
+            if (pane->terminal == terminal) return pane->child_pid;
+        }
+        return 0;
+    }
+    
+    // Otwiera zrzuconą na dysk historię zakładki w nowej zakładce tylko do odczytu
+    void show_spilled_scrollback(TerminalTab *source) {
+        std::string contents;
+        for (const auto &path : source->spill_files) {
+            if (!ScrollbackSpill::read(path, contents)) {
+                std::cerr << "Cannot read scrollback from " << path << std::endl;
+            }
+        }
         
-        // Przełączenie na nową zakładkę
-        gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), index);
-        gtk_widget_grab_focus(terminal);
+        TerminalTab *viewer = add_new_tab("Scrollback: " + source->title, "", true, true);
+        materialize_tab(viewer);
         
-        // Pokaż pasek zakładek, jeśli jest więcej niż jedna karta
-        if (tabs.size() > 1) {
-            gtk_notebook_set_show_tabs(GTK_NOTEBOOK(notebook), TRUE);
+        // Zapis zawiera same znaki nowej linii, terminal potrzebuje też powrotu karetki
+        std::string text;
+        text.reserve(contents.size() + contents.size() / 32);
+        for (char c : contents) {
+            if (c == '\n') text += '\r';
+            text += c;
         }
+        vte_terminal_feed(VTE_TERMINAL(viewer->terminal), text.data(), text.size());
         
-        g_print("Zakładka utworzona, indeks: %d\n", index);
+        gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), tabs.size() - 1);
+    }
+    
+    bool has_pending_tabs() const {
+        for (auto tab : tabs) {
+            if (!tab->terminal) return true;
+        }
+        return false;
     }
 
     void initialize_color_themes() {
@@ -844,7 +4464,48 @@ private:
             config.color_themes["Matrix"] = matrix;
             
             // Zapisz motywy do plików
-            config.save_config();
+            for (const auto &theme_pair : config.color_themes) {
+                config.mark_theme_dirty(theme_pair.first);
+            }
+            config.mark_settings_dirty();
+        }
+    }
+
+    // Przezroczystość wymaga wizualu RGBA, app_paintable i mieszania kanału alfa
+    // przez kompozytor. Przy transparency=0 (i render_path=auto) okno zostaje
+    // przy zwykłym wizualu ekranu, więc tego kosztu nie ponosimy.
+    void set_render_path(bool alpha) {
+        alpha_visual = alpha;
+        gtk_widget_set_visual(window, alpha ? gdk_screen_get_rgba_visual(gtk_widget_get_screen(window)) : NULL);
+        gtk_widget_set_app_paintable(window, alpha);
+    }
+    
+    // Zmiana ścieżki w działającym oknie. Wizualu zrealizowanego okna nie da
+    // się zmienić, więc okno jest na chwilę ukrywane i realizowane od nowa -
+    // terminale i ich powłoki zostają, zmieniają się tylko okna GDK.
+    void apply_render_path() {
+        bool alpha = config.uses_alpha();
+        if (alpha == alpha_visual) return;
+        
+        if (!gtk_widget_get_realized(window)) {
+            set_render_path(alpha);
+            return;
+        }
+        
+        bool visible = gtk_widget_get_visible(window);
+        gint x = 0, y = 0;
+        gtk_window_get_position(GTK_WINDOW(window), &x, &y);
+        
+        release_latency_frame_clock();
+        gtk_widget_hide(window);
+        gtk_widget_unrealize(window);
+        set_render_path(alpha);
+        if (visible) {
+            gtk_window_move(GTK_WINDOW(window), x, y);
+            gtk_widget_show(window);
+        }
+        if (replay) {
+            connect_replay_frame_clock();
         }
     }
 
@@ -859,12 +4520,10 @@ private:
             current_theme = &config.color_themes["Default"];
         }
         
-        // Ustawiamy przezroczystość tła
+        // Ustawiamy przezroczystość tła; ścieżka nieprzezroczysta dziedziczy zwykły wizual okna
+        bool alpha = config.uses_alpha();
         GdkScreen *screen = gtk_widget_get_screen(GTK_WIDGET(terminal));
-        GdkVisual *visual = gdk_screen_get_rgba_visual(screen);
-        if (visual != NULL) {
-            gtk_widget_set_visual(GTK_WIDGET(terminal), visual);
-        }
+        gtk_widget_set_visual(GTK_WIDGET(terminal), alpha ? gdk_screen_get_rgba_visual(screen) : NULL);
         
         // Sprawdź, czy paleta jest pusta i zainicjalizuj ją, jeśli tak
         bool needs_initialization = false;
@@ -898,168 +4557,705 @@ private:
         // Używamy globalnej przezroczystości, a nie przezroczystości z motywu
         // Modyfikujemy kolor tła, aby uwzględnić przezroczystość
         GdkRGBA bg_with_alpha = current_theme->background;
-        bg_with_alpha.alpha = 1.0 - config.transparency;
+        bg_with_alpha.alpha = alpha ? 1.0 - config.transparency : 1.0;
+        
+        // Tworzymy kopię palety kolorów, aby ustawić wartość alpha na 0 dla wszystkich kolorów.
+        // Ścieżka nieprzezroczysta używa palety motywu bez zmian.
+        GdkRGBA palette_copy[16];
+        const GdkRGBA *palette = current_theme->palette;
+        if (alpha) {
+            for (int i = 0; i < 16; i++) {
+                palette_copy[i] = current_theme->palette[i];
+                palette_copy[i].alpha = 0.0;  // Ustawiamy alpha na 0 dla wszystkich kolorów w palecie
+            }
+            palette = palette_copy;
+        }
+        
+        // Zastosowanie kolorów z aktualnego motywu
+        // Tekst pozostaje nieprzezroczysty, tylko tło jest przezroczyste
+        // Używamy wszystkich 16 kolorów z palety
+        vte_terminal_set_colors(terminal, &current_theme->foreground, &bg_with_alpha, palette, 16);
+        
+        // Upewnij się, że kolory są faktycznie stosowane
+        vte_terminal_set_color_foreground(terminal, &current_theme->foreground);
+        vte_terminal_set_color_background(terminal, &bg_with_alpha);
+        
+        // Kompozycja terminala jest potrzebna tylko przy przezroczystości
+        gtk_widget_set_app_paintable(GTK_WIDGET(terminal), alpha);
+        
+        // Minimalne debugowanie
+        std::cerr << "Zastosowano motyw: " << current_theme->name << std::endl;
+    }
+
+    void apply_font_to_terminal(VteTerminal *terminal) {
+        vte_terminal_set_font(terminal, get_font_description());
+    }
+    
+    // Opis czcionki budowany raz na zmianę ustawień i wspólny dla wszystkich terminali i paneli
+    PangoFontDescription *get_font_description() {
+        if (!font_description || font_description_family != config.font_family ||
+            font_description_size != config.font_size) {
+            if (font_description) {
+                pango_font_description_free(font_description);
+            }
+            font_description = pango_font_description_from_string(config.font_family.c_str());
+            pango_font_description_set_size(font_description, (int)(config.font_size * PANGO_SCALE));
+            font_description_family = config.font_family;
+            font_description_size = config.font_size;
+        }
+        return font_description;
+    }
+
+    // argv polecenia zakładki albo powłoki użytkownika; wskaźniki żyją tak długo jak command
+    static std::vector<gchar*> build_argv(const std::vector<std::string> &command) {
+        std::vector<gchar*> argv;
+        if (command.empty()) {
+            const gchar *shell = getenv("SHELL");
+            argv.push_back((gchar*)(shell ? shell : "/bin/bash"));
+        } else {
+            for (const auto &arg : command) {
+                argv.push_back((gchar*)arg.c_str());
+            }
+        }
+        argv.push_back(nullptr);
+        return argv;
+    }
+
+    void spawn_shell(VteTerminal *terminal, GPid *child_pid, const std::string &working_directory = "",
+                     const std::vector<std::string> &command = {}) {
+        std::vector<gchar*> argv = build_argv(command);
+        gchar *envp[] = {nullptr};
+        
+        // Callback do obsługi zakończenia procesu
+        auto spawn_callback = [](VteTerminal *terminal, GPid pid, GError *error, gpointer user_data) {
+            if (error) {
+                g_warning("Error spawning terminal: %s", error->message);
+                return;
+            }
+            
+            GPid *child_pid_ptr = static_cast<GPid*>(user_data);
+            if (child_pid_ptr) {
+                *child_pid_ptr = pid;
+            }
+            
+            StartupProfiler::mark_shell_spawned();
+        };
+
+        vte_terminal_spawn_async(
+            terminal,
+            VTE_PTY_DEFAULT,
+            working_directory.empty() ? nullptr : working_directory.c_str(),
+            argv.data(),
+            envp,
+            command.empty() ? G_SPAWN_DEFAULT : G_SPAWN_SEARCH_PATH,
+            nullptr,
+            nullptr,
+            nullptr,  // Nie używamy child_setup_data_destroy
+            -1,
+            nullptr,
+            (VteTerminalSpawnAsyncCallback)spawn_callback,
+            child_pid
+        );
+    }
+
+    // Pasek wyszukiwania nad terminalem: szuka w trakcie pisania w bieżącej
+    // zakładce, a liczba dopasowań jest liczona w tle przez MatchCounter
+    void create_search_bar() {
+        search_bar = gtk_search_bar_new();
+        gtk_search_bar_set_show_close_button(GTK_SEARCH_BAR(search_bar), TRUE);
+        
+        GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+        search_entry = gtk_search_entry_new();
+        gtk_widget_set_size_request(search_entry, 300, -1);
+        gtk_box_pack_start(GTK_BOX(box), search_entry, TRUE, TRUE, 0);
+        
+        GtkWidget *previous_button = gtk_button_new_from_icon_name("go-up-symbolic", GTK_ICON_SIZE_BUTTON);
+        gtk_widget_set_tooltip_text(previous_button, "Previous match (Enter)");
+        gtk_box_pack_start(GTK_BOX(box), previous_button, FALSE, FALSE, 0);
+        
+        GtkWidget *next_button = gtk_button_new_from_icon_name("go-down-symbolic", GTK_ICON_SIZE_BUTTON);
+        gtk_widget_set_tooltip_text(next_button, "Next match (Shift+Enter)");
+        gtk_box_pack_start(GTK_BOX(box), next_button, FALSE, FALSE, 0);
+        
+        search_regex_check = gtk_check_button_new_with_label("Regular expression");
+        gtk_box_pack_start(GTK_BOX(box), search_regex_check, FALSE, FALSE, 0);
+        
+        search_case_check = gtk_check_button_new_with_label("Case sensitive");
+        gtk_box_pack_start(GTK_BOX(box), search_case_check, FALSE, FALSE, 0);
+        
+        GtkWidget *all_tabs_button = gtk_button_new_with_label("All Tabs");
+        gtk_widget_set_tooltip_text(all_tabs_button, "Search all tabs");
+        gtk_box_pack_start(GTK_BOX(box), all_tabs_button, FALSE, FALSE, 0);
+        
+        search_count_label = gtk_label_new("");
+        gtk_box_pack_start(GTK_BOX(box), search_count_label, FALSE, FALSE, 5);
+        
+        gtk_container_add(GTK_CONTAINER(search_bar), box);
+        gtk_search_bar_connect_entry(GTK_SEARCH_BAR(search_bar), GTK_ENTRY(search_entry));
+        
+        g_signal_connect(search_entry, "search-changed", G_CALLBACK(on_search_changed), this);
+        g_signal_connect(search_entry, "activate", G_CALLBACK(on_search_entry_activate), this);
+        g_signal_connect(search_entry, "previous-match", G_CALLBACK(on_search_previous), this);
+        g_signal_connect(search_entry, "next-match", G_CALLBACK(on_search_next), this);
+        g_signal_connect(search_entry, "stop-search", G_CALLBACK(on_search_stop), this);
+        g_signal_connect(previous_button, "clicked", G_CALLBACK(on_search_previous), this);
+        g_signal_connect(next_button, "clicked", G_CALLBACK(on_search_next), this);
+        g_signal_connect(search_regex_check, "toggled", G_CALLBACK(on_search_changed), this);
+        g_signal_connect(search_case_check, "toggled", G_CALLBACK(on_search_changed), this);
+        g_signal_connect(all_tabs_button, "clicked", G_CALLBACK(on_search_all_tabs), this);
+    }
+    
+    // Powłoka na własnym PTY: każdy bajt wyjścia przechodzi przez rejestrator,
+    // bez dodatkowego procesu jak script(1)
+    void spawn_recorded_shell(TerminalTab *tab) {
+        VteTerminal *terminal = VTE_TERMINAL(tab->terminal);
+        GError *error = NULL;
+        VtePty *pty = vte_pty_new_sync(VTE_PTY_DEFAULT, NULL, &error);
+        if (!pty) {
+            g_warning("Cannot create PTY for recording, starting without it: %s", error->message);
+            g_error_free(error);
+            spawn_shell(terminal, &tab->child_pid, tab->working_directory, tab->command);
+            return;
+        }
+        
+        int fd = vte_pty_get_fd(pty);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        vte_pty_set_size(pty, vte_terminal_get_row_count(terminal), vte_terminal_get_column_count(terminal), NULL);
+        tab->proxy_pty = pty;
+        
+        std::string dir = config.record_dir.empty() ? OutputRecorder::get_default_dir() : config.record_dir;
+        tab->recorder = OutputRecorder::open(OutputRecorder::new_base_path(dir),
+                                             config.record_timestamps, config.record_plain_text, config.record_asciicast,
+                                             vte_terminal_get_column_count(terminal), vte_terminal_get_row_count(terminal));
+        
+        g_signal_connect(terminal, "commit", G_CALLBACK(on_proxy_commit), tab);
+        g_signal_connect_after(terminal, "size-allocate", G_CALLBACK(on_proxy_resize), tab);
+        tab->proxy_source_id = g_unix_fd_add(fd, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR), on_proxy_output, tab);
+        
+        std::vector<gchar*> argv = build_argv(tab->command);
+        gchar *envp[] = {nullptr};
+        GSpawnFlags flags = (GSpawnFlags)(G_SPAWN_DO_NOT_REAP_CHILD | (tab->command.empty() ? 0 : G_SPAWN_SEARCH_PATH));
+        
+        vte_pty_spawn_async(pty,
+                            tab->working_directory.empty() ? nullptr : tab->working_directory.c_str(),
+                            argv.data(), envp, flags,
+                            nullptr, nullptr, nullptr, -1,
+                            tab->spawn_cancellable, on_proxy_spawned, tab);
+    }
+    
+    static void on_proxy_spawned(GObject *source, GAsyncResult *result, gpointer data) {
+        GError *error = NULL;
+        GPid pid = 0;
+        if (!vte_pty_spawn_finish(VTE_PTY(source), result, &pid, &error)) {
+            // Anulowanie oznacza, że zakładka została już zamknięta
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_warning("Error spawning terminal: %s", error->message);
+            }
+            g_error_free(error);
+            return;
+        }
+        
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        tab->child_pid = pid;
+        g_child_watch_add(pid, on_proxy_child_exited, NULL);
+        StartupProfiler::mark_shell_spawned();
+    }
+    
+    // Wyjście powłoki: najpierw do rejestratora, potem do terminala
+    static gboolean on_proxy_output(gint fd, GIOCondition condition, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        char buffer[65536];
+        
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        if (bytes_read > 0) {
+            tab->recorder->record(buffer, bytes_read);
+            vte_terminal_feed(VTE_TERMINAL(tab->terminal), buffer, bytes_read);
+            return G_SOURCE_CONTINUE;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR) && !(condition & (G_IO_HUP | G_IO_ERR))) {
+            return G_SOURCE_CONTINUE;
+        }
+        
+        // EOF albo EIO - powłoka zamknęła PTY, zakładkę zamknie on_proxy_child_exited
+        tab->proxy_source_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Wejście z klawiatury i odpowiedzi terminala trafiają do powłoki. Przy
+    // pełnym buforze PTY reszta czeka w proxy_pending, żeby nie blokować pętli
+    // GTK, i jest dopisywana przez on_proxy_writable.
+    static void on_proxy_commit(VteTerminal *terminal, gchar *text, guint size, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        // Zachowanie kolejności: nowe wejście nie może wyprzedzić czekającego
+        if (!tab->proxy_pending.empty()) {
+            tab->proxy_pending.append(text, size);
+            return;
+        }
+        
+        int fd = vte_pty_get_fd(tab->proxy_pty);
+        while (size > 0) {
+            ssize_t written = write(fd, text, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) return;  // PTY zamknięte - powłoka już nie odczyta wejścia
+                
+                tab->proxy_pending.assign(text, size);
+                tab->proxy_write_source_id = g_unix_fd_add(fd, G_IO_OUT, on_proxy_writable, tab);
+                return;
+            }
+            text += written;
+            size -= written;
+        }
+    }
+    
+    static gboolean on_proxy_writable(gint fd, GIOCondition condition, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        while (!tab->proxy_pending.empty()) {
+            ssize_t written = write(fd, tab->proxy_pending.data(), tab->proxy_pending.size());
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) return G_SOURCE_CONTINUE;
+                tab->proxy_pending.clear();
+                break;
+            }
+            tab->proxy_pending.erase(0, written);
+        }
+        
+        tab->proxy_write_source_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    
+    static void on_proxy_resize(GtkWidget *widget, GdkRectangle *allocation, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        VteTerminal *terminal = VTE_TERMINAL(widget);
+        glong columns = vte_terminal_get_column_count(terminal);
+        glong rows = vte_terminal_get_row_count(terminal);
+        
+        // size-allocate przychodzi także bez zmiany liczby wierszy i kolumn
+        int old_rows = 0, old_columns = 0;
+        vte_pty_get_size(tab->proxy_pty, &old_rows, &old_columns, NULL);
+        if (old_rows == rows && old_columns == columns) return;
+        
+        vte_pty_set_size(tab->proxy_pty, rows, columns, NULL);
+        tab->recorder->record_resize(columns, rows);
+    }
+    
+    static void on_proxy_child_exited(GPid pid, gint status, gpointer data) {
+        g_spawn_close_pid(pid);
+        for (auto win : windows) {
+            for (size_t i = 0; i < win->tabs.size(); i++) {
+                if (win->tabs[i]->child_pid == pid) {
+                    win->tabs[i]->child_pid = 0;
+                    win->close_pane(win->tabs[i], win->tabs[i]->terminal, false);
+                    return;
+                }
+            }
+        }
+    }
+    
+    static void on_record_toggled(GtkCheckMenuItem *item, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->config.record_output = gtk_check_menu_item_get_active(item);
+        self->config.mark_settings_dirty();
+    }
+    
+    // Stan opcji nagrywania jest wspólny dla okien i może zmienić się w config.ini
+    static void on_main_menu_show(GtkWidget *menu, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        g_signal_handlers_block_by_func(self->record_item, (gpointer)on_record_toggled, self);
+        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(self->record_item), self->config.record_output);
+        g_signal_handlers_unblock_by_func(self->record_item, (gpointer)on_record_toggled, self);
+    }
+
+    void show_search_bar() {
+        gtk_search_bar_set_search_mode(GTK_SEARCH_BAR(search_bar), TRUE);
+        gtk_widget_grab_focus(search_entry);
+    }
+    
+    // Wzorzec z paska wyszukiwania z pamięci podręcznej; błąd jest pokazywany przy polu
+    const RegexCache::Entry *get_search_pattern() {
+        const char *text = gtk_entry_get_text(GTK_ENTRY(search_entry));
+        GtkStyleContext *style = gtk_widget_get_style_context(search_entry);
+        if (*text == '\0') {
+            gtk_style_context_remove_class(style, "error");
+            gtk_widget_set_tooltip_text(search_entry, NULL);
+            return nullptr;
+        }
+        
+        GError *error = NULL;
+        const RegexCache::Entry *pattern = RegexCache::lookup(
+            text,
+            gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(search_regex_check)),
+            gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(search_case_check)),
+            &error);
+        
+        if (error) {
+            gtk_style_context_add_class(style, "error");
+            gtk_widget_set_tooltip_text(search_entry, error->message);
+            gtk_label_set_text(GTK_LABEL(search_count_label), "");
+            g_error_free(error);
+            return nullptr;
+        }
+        gtk_widget_set_tooltip_text(search_entry, NULL);
+        return pattern;
+    }
+    
+    // Ustawia wzorzec w bieżącym terminalu i przechodzi do dopasowania
+    void search_step(bool backward) {
+        TerminalTab *tab = get_current_tab();
+        if (!tab || !tab->terminal) return;
+        VteTerminal *terminal = VTE_TERMINAL(tab->active_terminal());
+        
+        const RegexCache::Entry *pattern = get_search_pattern();
+        vte_terminal_search_set_regex(terminal, pattern ? pattern->vte_regex : NULL, 0);
+        if (!pattern) {
+            vte_terminal_unselect_all(terminal);
+            return;
+        }
+        
+        vte_terminal_search_set_wrap_around(terminal, TRUE);
+        gboolean found = backward ? vte_terminal_search_find_previous(terminal)
+                                  : vte_terminal_search_find_next(terminal);
+        
+        GtkStyleContext *style = gtk_widget_get_style_context(search_entry);
+        if (found) {
+            gtk_style_context_remove_class(style, "error");
+        } else {
+            gtk_style_context_add_class(style, "error");
+        }
+    }
+    
+    // Liczenie dopasowań w bieżącej zakładce w wątku MatchCounter. Tekst
+    // terminala jest kopiowany (w wątku GTK, bo VTE nie jest wątkowo
+    // bezpieczne) tylko wtedy, gdy zmieniła się jego zawartość.
+    void count_matches() {
+        stop_match_count();
+        
+        TerminalTab *tab = get_current_tab();
+        const RegexCache::Entry *pattern = get_search_pattern();
+        if (!tab || !tab->terminal || !pattern) {
+            gtk_label_set_text(GTK_LABEL(search_count_label), "");
+            return;
+        }
+        
+        GtkWidget *terminal = tab->active_terminal();
+        if (!count_text || count_text_terminal != terminal) {
+            snapshot_count_text(terminal);
+        }
+        
+        if (!match_counter) {
+            match_counter = new MatchCounter();
+        }
+        count_generation = match_counter->request(g_regex_ref(pattern->regex), count_text);
+        count_poll_id = g_timeout_add(SEARCH_POLL_MS, on_count_poll, this);
+    }
+    
+    void stop_match_count() {
+        if (count_delay_id != 0) {
+            g_source_remove(count_delay_id);
+            count_delay_id = 0;
+        }
+        if (count_poll_id != 0) {
+            g_source_remove(count_poll_id);
+            count_poll_id = 0;
+        }
+    }
+    
+    void snapshot_count_text(GtkWidget *widget) {
+        release_count_text();
+        
+        VteTerminal *terminal = VTE_TERMINAL(widget);
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        count_text = std::make_shared<const std::string>(
+            get_text_rows(terminal, (glong)gtk_adjustment_get_lower(adjustment),
+                          (glong)gtk_adjustment_get_upper(adjustment) - 1));
+        
+        // Referencja pozwala bezpiecznie odłączyć sygnał także po zamknięciu terminala
+        count_text_terminal = GTK_WIDGET(g_object_ref(widget));
+        g_signal_connect(widget, "contents-changed", G_CALLBACK(on_count_text_changed), this);
+    }
+    
+    void release_count_text() {
+        if (count_text_terminal) {
+            // close_pane mógł już odłączyć wszystkie sygnały tego okna
+            g_signal_handlers_disconnect_by_func(count_text_terminal, (gpointer)on_count_text_changed, this);
+            g_object_unref(count_text_terminal);
+            count_text_terminal = nullptr;
+        }
+        count_text.reset();
+    }
+    
+    static void on_count_text_changed(VteTerminal *terminal, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->count_text.reset();
+    }
+    
+    static gboolean on_count_delay(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->count_delay_id = 0;
+        self->count_matches();
+        return G_SOURCE_REMOVE;
+    }
+    
+    static gboolean on_count_poll(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
         
-        // Tworzymy kopię palety kolorów, aby ustawić wartość alpha na 0 dla wszystkich kolorów
-        GdkRGBA palette_copy[16];
-        for (int i = 0; i < 16; i++) {
-            palette_copy[i] = current_theme->palette[i];
-            palette_copy[i].alpha = 0.0;  // Ustawiamy alpha na 0 dla wszystkich kolorów w palecie
+        size_t count = 0;
+        if (!self->match_counter->result(self->count_generation, count)) {
+            return G_SOURCE_CONTINUE;
         }
         
-        // Zastosowanie kolorów z aktualnego motywu
-        // Tekst pozostaje nieprzezroczysty, tylko tło jest przezroczyste
-        // Używamy wszystkich 16 kolorów z palety
-        vte_terminal_set_colors(terminal, &current_theme->foreground, &bg_with_alpha, palette_copy, 16);
+        std::string text = std::to_string(count);
+        if (count >= MatchCounter::MAX_MATCHES) {
+            text += "+";
+        }
+        text += count == 1 ? " match" : " matches";
+        gtk_label_set_text(GTK_LABEL(self->search_count_label), text.c_str());
         
-        // Upewnij się, że kolory są faktycznie stosowane
-        vte_terminal_set_color_foreground(terminal, &current_theme->foreground);
-        vte_terminal_set_color_background(terminal, &bg_with_alpha);
+        self->count_poll_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Podświetlenie od razu, liczenie dopiero po przerwie w pisaniu
+    static void on_search_changed(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->search_step(true);
         
-        // Włączamy obsługę kompozycji dla terminala
-        gtk_widget_set_app_paintable(GTK_WIDGET(terminal), TRUE);
+        if (self->count_delay_id != 0) {
+            g_source_remove(self->count_delay_id);
+        }
+        self->count_delay_id = g_timeout_add(SEARCH_COUNT_DELAY_MS, on_count_delay, self);
+    }
+    
+    // Enter szuka starszych wyników, Shift+Enter nowszych
+    static void on_search_entry_activate(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        GdkModifierType state;
+        bool shift = gtk_get_current_event_state(&state) && (state & GDK_SHIFT_MASK);
+        self->search_step(!shift);
+    }
+    
+    static void on_search_previous(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->search_step(true);
+    }
+    
+    static void on_search_next(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->search_step(false);
+    }
+    
+    static void on_search_stop(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->stop_match_count();
+        self->release_count_text();
+        gtk_search_bar_set_search_mode(GTK_SEARCH_BAR(self->search_bar), FALSE);
         
-        // Minimalne debugowanie
-        std::cerr << "Zastosowano motyw: " << current_theme->name << std::endl;
+        TerminalTab *tab = self->get_current_tab();
+        if (tab && tab->terminal) {
+            gtk_widget_grab_focus(tab->active_terminal());
+        }
     }
-
-    void apply_theme_to_all_terminals() {
-        for (auto tab : tabs) {
-            apply_theme_to_terminal(VTE_TERMINAL(tab->terminal));
+    
+    static void on_search_all_tabs(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        const RegexCache::Entry *pattern = self->get_search_pattern();
+        if (pattern) {
+            self->start_all_tabs_search(pattern->regex);
         }
     }
+    
+    // Kopia tekstu zakładki dla wątków wyszukiwania (VTE działa tylko w wątku GTK)
+    static TabSearch::Snapshot snapshot_tab(TerminalTab *tab, GtkWidget *widget) {
+        VteTerminal *terminal = VTE_TERMINAL(widget);
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        glong first_row = (glong)gtk_adjustment_get_lower(adjustment);
+        glong last_row = (glong)gtk_adjustment_get_upper(adjustment) - 1;
+        
+        // Numery wierszy zawiniętych linii liczy wątek wyszukiwania z liczby kolumn
+        return {tab->id, tab->title, first_row, vte_terminal_get_column_count(terminal),
+                get_text_rows(terminal, first_row, last_row)};
+    }
 
-    void spawn_shell(VteTerminal *terminal, GPid *child_pid) {
-        const gchar *shell = getenv("SHELL");
-        if (shell == nullptr) {
-            shell = "/bin/bash";
+    // Wyszukiwanie we wszystkich zakładkach wszystkich okien. Snapshot tekstu
+    // powstaje po jednej zakładce na przebieg pętli, dopasowywanie odbywa się
+    // w wątkach TabSearch, a wyniki co SEARCH_POLL_MS trafiają do panelu.
+    void start_all_tabs_search(GRegex *regex) {
+        stop_all_tabs_search();
+        
+        ensure_search_panel();
+        gtk_list_store_clear(search_store);
+        search_hits.clear();
+        search_hit_tabs.clear();
+        gtk_label_set_text(GTK_LABEL(search_status), "Searching...");
+        gtk_widget_show_all(search_panel);
+        
+        for (auto win : windows) {
+            for (auto tab : win->tabs) {
+                if (tab->terminal && !tab->read_only) {
+                    search_pending.push_back(tab->id);
+                }
+            }
         }
-
-        gchar *envp[] = {nullptr};
         
-        // Callback do obsługi zakończenia procesu
-        auto spawn_callback = [](VteTerminal *terminal, GPid pid, GError *error, gpointer user_data) {
-            if (error) {
-                g_warning("Error spawning terminal: %s", error->message);
-                return;
-            }
-            
-            GPid *child_pid_ptr = static_cast<GPid*>(user_data);
-            if (child_pid_ptr) {
-                *child_pid_ptr = pid;
-            }
-        };
-
-        vte_terminal_spawn_async(
-            terminal,
-            VTE_PTY_DEFAULT,
-            nullptr,
-            (char *[]){(char*)shell, nullptr},
-            envp,
-            G_SPAWN_DEFAULT,
-            nullptr,
-            nullptr,
-            nullptr,  // Nie używamy child_setup_data_destroy
-            -1,
-            nullptr,
-            (VteTerminalSpawnAsyncCallback)spawn_callback,
-            child_pid
-        );
+        tab_search = new TabSearch(g_regex_ref(regex));
+        search_snapshot_id = g_idle_add(on_search_snapshot_idle, this);
+        search_poll_id = g_timeout_add(SEARCH_POLL_MS, on_search_poll, this);
     }
-
-    void show_search_dialog() {
-        int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook));
-        if (current_page < 0 || current_page >= static_cast<int>(tabs.size())) {
-            return;
+    
+    void stop_all_tabs_search() {
+        if (search_snapshot_id != 0) {
+            g_source_remove(search_snapshot_id);
+            search_snapshot_id = 0;
         }
+        if (search_poll_id != 0) {
+            g_source_remove(search_poll_id);
+            search_poll_id = 0;
+        }
+        search_pending.clear();
+        delete tab_search;
+        tab_search = nullptr;
+    }
+    
+    void ensure_search_panel() {
+        if (search_panel) return;
         
-        GtkWidget *dialog = gtk_dialog_new_with_buttons(
-            "Search", GTK_WINDOW(window),
-            (GtkDialogFlags)(GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT),
-            "_Cancel", GTK_RESPONSE_CANCEL,
-            "_Search", GTK_RESPONSE_ACCEPT,
-            NULL);
-            
-        GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-        
-        GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
-        gtk_container_set_border_width(GTK_CONTAINER(box), 10);
-        
-        GtkWidget *label = gtk_label_new("Search for:");
-        GtkWidget *entry = gtk_entry_new();
-        gtk_entry_set_activates_default(GTK_ENTRY(entry), TRUE);
+        search_panel = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
         
-        gtk_box_pack_start(GTK_BOX(box), label, FALSE, FALSE, 0);
-        gtk_box_pack_start(GTK_BOX(box), entry, TRUE, TRUE, 0);
+        GtkWidget *header = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+        gtk_container_set_border_width(GTK_CONTAINER(header), 3);
+        search_status = gtk_label_new("");
+        gtk_label_set_xalign(GTK_LABEL(search_status), 0.0);
+        gtk_box_pack_start(GTK_BOX(header), search_status, TRUE, TRUE, 0);
         
-        gtk_container_add(GTK_CONTAINER(content_area), box);
+        GtkWidget *close_button = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_MENU);
+        gtk_button_set_relief(GTK_BUTTON(close_button), GTK_RELIEF_NONE);
+        g_signal_connect(close_button, "clicked", G_CALLBACK(on_search_panel_close), this);
+        gtk_box_pack_start(GTK_BOX(header), close_button, FALSE, FALSE, 0);
+        gtk_box_pack_start(GTK_BOX(search_panel), header, FALSE, FALSE, 0);
+        
+        search_store = gtk_list_store_new(HIT_N_COLUMNS, G_TYPE_STRING, G_TYPE_LONG, G_TYPE_STRING, G_TYPE_INT);
+        GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(search_store));
+        g_object_unref(search_store);
+        
+        GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+        gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Tab", renderer, "text", HIT_COLUMN_TAB, NULL);
+        renderer = gtk_cell_renderer_text_new();
+        gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Line", renderer, "text", HIT_COLUMN_LINE, NULL);
+        renderer = gtk_cell_renderer_text_new();
+        g_object_set(renderer, "family", "Monospace", "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+        gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Context", renderer, "text", HIT_COLUMN_CONTEXT, NULL);
+        g_signal_connect(view, "row-activated", G_CALLBACK(on_search_hit_activated), this);
+        
+        GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+        gtk_widget_set_size_request(scrolled, -1, 180);
+        gtk_container_add(GTK_CONTAINER(scrolled), view);
+        gtk_box_pack_start(GTK_BOX(search_panel), scrolled, TRUE, TRUE, 0);
+        
+        gtk_box_pack_end(GTK_BOX(main_box), search_panel, FALSE, FALSE, 0);
+    }
+    
+    void update_search_status(bool done) {
+        std::string status = std::to_string(search_hits.size()) + " matches in " +
+                             std::to_string(search_hit_tabs.size()) + " tabs";
+        if (tab_search && tab_search->hit_limit_reached()) {
+            status += " (limit reached)";
+        }
+        if (!done) {
+            status += ", searching...";
+        }
+        gtk_label_set_text(GTK_LABEL(search_status), status.c_str());
+    }
+    
+    static gboolean on_search_snapshot_idle(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
         
-        GtkWidget *regex_check = gtk_check_button_new_with_label("Regular expression");
-        gtk_container_add(GTK_CONTAINER(content_area), regex_check);
+        while (!self->search_pending.empty()) {
+            unsigned id = self->search_pending.front();
+            self->search_pending.pop_front();
+            
+            // Zakładka mogła zostać zamknięta w trakcie wyszukiwania
+            TerminalWindow *win = nullptr;
+            TerminalTab *tab = find_tab(id, &win);
+            if (!tab || !tab->terminal) continue;
+            
+            self->tab_search->add(snapshot_tab(tab, tab->terminal));
+            return G_SOURCE_CONTINUE;
+        }
         
-        GtkWidget *case_check = gtk_check_button_new_with_label("Case sensitive");
-        gtk_container_add(GTK_CONTAINER(content_area), case_check);
+        self->tab_search->finish_input();
+        self->search_snapshot_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    
+    static gboolean on_search_poll(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
         
-        gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
-        gtk_widget_show_all(dialog);
+        bool done = false;
+        for (auto &hit : self->tab_search->take_hits(done)) {
+            GtkTreeIter iter;
+            gtk_list_store_append(self->search_store, &iter);
+            gtk_list_store_set(self->search_store, &iter,
+                               HIT_COLUMN_TAB, hit.title.c_str(),
+                               HIT_COLUMN_LINE, hit.row + 1,
+                               HIT_COLUMN_CONTEXT, hit.context.c_str(),
+                               HIT_COLUMN_INDEX, (int)self->search_hits.size(),
+                               -1);
+            self->search_hit_tabs.insert(hit.tab_id);
+            self->search_hits.push_back(std::move(hit));
+        }
         
-        if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
-            const char *text = gtk_entry_get_text(GTK_ENTRY(entry));
-            gboolean regex = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(regex_check));
-            gboolean case_sensitive = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(case_check));
-            
-            VteRegex *regex_obj = NULL;
-            GError *error = NULL;
-            
-            // Używamy G_REGEX_CASELESS zamiast PCRE2_CASELESS
-            if (regex) {
-                regex_obj = vte_regex_new_for_search(text, -1, case_sensitive ? 0 : G_REGEX_CASELESS, &error);
-            } else {
-                // Escape regex special characters for literal search
-                std::string escaped = "";
-                for (const char *p = text; *p; p++) {
-                    if (strchr("[]{}().*+?|^$\\", *p)) {
-                        escaped += '\\';
-                    }
-                    escaped += *p;
-                }
-                regex_obj = vte_regex_new_for_search(escaped.c_str(), -1, case_sensitive ? 0 : G_REGEX_CASELESS, &error);
-            }
-            
-            if (error) {
-                GtkWidget *error_dialog = gtk_message_dialog_new(
-                    GTK_WINDOW(dialog),
-                    GTK_DIALOG_DESTROY_WITH_PARENT,
-                    GTK_MESSAGE_ERROR,
-                    GTK_BUTTONS_CLOSE,
-                    "Error in search pattern: %s", error->message);
-                gtk_dialog_run(GTK_DIALOG(error_dialog));
-                gtk_widget_destroy(error_dialog);
-                g_error_free(error);
-            } else if (regex_obj) {
-                VteTerminal *terminal = VTE_TERMINAL(tabs[current_page]->terminal);
-                vte_terminal_search_set_regex(terminal, regex_obj, 0);
-                vte_terminal_search_set_wrap_around(terminal, TRUE);
-                
-                if (!vte_terminal_search_find_next(terminal)) {
-                    GtkWidget *info_dialog = gtk_message_dialog_new(
-                        GTK_WINDOW(window),
-                        GTK_DIALOG_DESTROY_WITH_PARENT,
-                        GTK_MESSAGE_INFO,
-                        GTK_BUTTONS_OK,
-                        "Pattern not found");
-                    gtk_dialog_run(GTK_DIALOG(info_dialog));
-                    gtk_widget_destroy(info_dialog);
-                }
-                
-                vte_regex_unref(regex_obj);
-            }
+        done = done && self->search_snapshot_id == 0;
+        self->update_search_status(done);
+        if (!done) {
+            return G_SOURCE_CONTINUE;
         }
         
-        gtk_widget_destroy(dialog);
+        self->search_poll_id = 0;
+        delete self->tab_search;
+        self->tab_search = nullptr;
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Przejście do zakładki i wiersza wybranego wyniku
+    static void on_search_hit_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *column, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        
+        GtkTreeIter iter;
+        if (!gtk_tree_model_get_iter(GTK_TREE_MODEL(self->search_store), &iter, path)) return;
+        int index = -1;
+        gtk_tree_model_get(GTK_TREE_MODEL(self->search_store), &iter, HIT_COLUMN_INDEX, &index, -1);
+        if (index < 0 || index >= (int)self->search_hits.size()) return;
+        
+        const TabSearch::Hit &hit = self->search_hits[index];
+        TerminalWindow *win = nullptr;
+        TerminalTab *tab = find_tab(hit.tab_id, &win);
+        if (!tab || !tab->terminal) return;
+        
+        auto it = std::find(win->tabs.begin(), win->tabs.end(), tab);
+        gtk_notebook_set_current_page(GTK_NOTEBOOK(win->notebook), it - win->tabs.begin());
+        win->present();
+        
+        // Wiersz z wynikiem na środku ekranu
+        VteTerminal *terminal = VTE_TERMINAL(tab->terminal);
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        double value = hit.row - vte_terminal_get_row_count(terminal) / 2;
+        value = std::clamp(value, gtk_adjustment_get_lower(adjustment),
+                           gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_page_size(adjustment));
+        gtk_adjustment_set_value(adjustment, value);
+        gtk_widget_grab_focus(tab->terminal);
+    }
+    
+    static void on_search_panel_close(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->stop_all_tabs_search();
+        gtk_widget_hide(self->search_panel);
     }
 
     void show_theme_dialog() {
+        // Katalog motywów mógł jeszcze nie zostać w pełni wczytany w tle
+        config.ensure_all_themes_loaded();
+        
         GtkWidget *dialog = gtk_dialog_new_with_buttons(
             "Select Theme", GTK_WINDOW(window),
             (GtkDialogFlags)(GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT),
@@ -1115,7 +5311,7 @@ private:
                         apply_theme_to_all_terminals();
                         
                         // Zapisz konfigurację po zmianie
-                        config.save_config();
+                        config.mark_settings_dirty();
                         break;
                     }
                     index++;
@@ -1134,63 +5330,85 @@ private:
         return nullptr;
     }
 
-    // Sprawdza, czy w terminalu jest uruchomiony proces inny niż domyślna powłoka
-    bool has_foreground_process(TerminalTab *tab) {
-        // Jeśli nie ma procesu potomnego, nie ma co sprawdzać
-        if (tab->child_pid <= 0) return false;
-        
-        // Sprawdź, czy proces ma dzieci (co oznacza, że uruchomiono inny program)
-        char proc_path[256];
-        snprintf(proc_path, sizeof(proc_path), "/proc/%d/task/%d/children", tab->child_pid, tab->child_pid);
-        
-        FILE *f = fopen(proc_path, "r");
-        if (!f) return false;
-        
-        char buffer[1024];
-        size_t bytes_read = fread(buffer, 1, sizeof(buffer) - 1, f);
-        fclose(f);
-        
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            // Jeśli są jakieś procesy potomne, to znaczy, że coś jest uruchomione
-            if (strlen(buffer) > 0) {
-                return true;
+    // Nazwa polecenia, które zajmuje dany terminal zakładki, albo pusty napis, gdy na
+    // pierwszym planie jest sama powłoka. Grupa pierwszoplanowa pochodzi z PTY
+    // (tcgetpgrp), więc obejmuje też zadania, które nie są dziećmi powłoki.
+    std::string get_foreground_command(TerminalTab *tab, GtkWidget *terminal) {
+        GPid shell = get_terminal_pid(tab, terminal);
+        if (shell <= 0) return "";
+        
+        // Nagrywana zakładka ma powłokę głównego terminala na własnym PTY
+        VtePty *pty = (terminal == tab->terminal && tab->proxy_pty) ? tab->proxy_pty
+                                                                    : vte_terminal_get_pty(VTE_TERMINAL(terminal));
+        if (!pty) return "";
+        
+        pid_t group = tcgetpgrp(vte_pty_get_fd(pty));
+        if (group <= 0 || group == shell) return "";
+        
+        // Nazwę czytamy tylko dla znalezionego zadania
+        std::string command;
+        std::ifstream comm("/proc/" + std::to_string(group) + "/comm");
+        if (!std::getline(comm, command) || command.empty()) {
+            command = "process " + std::to_string(group);
+        }
+        return command;
+    }
+    
+    // Polecenia zajmujące terminale zakładki, łącznie z panelami
+    std::vector<std::string> get_running_commands(TerminalTab *tab) {
+        std::vector<std::string> running;
+        for (GtkWidget *terminal : tab->all_terminals()) {
+            std::string command = get_foreground_command(tab, terminal);
+            if (!command.empty()) {
+                running.push_back(command);
             }
         }
+        return running;
+    }
+    
+    // Jedno pytanie o zamknięcie z listą uruchomionych poleceń
+    bool confirm_close(const char *question, const std::vector<std::string> &running) {
+        std::string details = "Running:";
+        for (const auto &line : running) {
+            details += "\n  " + line;
+        }
         
-        return false;
+        GtkWidget *dialog = gtk_message_dialog_new(
+            GTK_WINDOW(window),
+            GTK_DIALOG_MODAL,
+            GTK_MESSAGE_QUESTION,
+            GTK_BUTTONS_YES_NO,
+            "%s", question);
+        gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog), "%s", details.c_str());
+        
+        int response = gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+        return response == GTK_RESPONSE_YES;
     }
 
-    void close_tab(int tab_index) {
+    void close_tab(int tab_index, bool confirm = true) {
         if (tab_index >= 0 && tab_index < static_cast<int>(tabs.size())) {
             TerminalTab *tab = tabs[tab_index];
             
-            // Sprawdź, czy w terminalu jest uruchomiony jakiś proces
-            if (has_foreground_process(tab)) {
-                GtkWidget *dialog = gtk_message_dialog_new(
-                    GTK_WINDOW(window),
-                    GTK_DIALOG_MODAL,
-                    GTK_MESSAGE_QUESTION,
-                    GTK_BUTTONS_YES_NO,
-                    "There is a process running in this terminal. Close anyway?");
-                
-                int response = gtk_dialog_run(GTK_DIALOG(dialog));
-                gtk_widget_destroy(dialog);
-                
-                if (response != GTK_RESPONSE_YES) {
-                    return;  // Anuluj zamknięcie
-                }
+            // Sprawdź, czy w terminalach zakładki jest uruchomiony jakiś proces
+            std::vector<std::string> running = confirm ? get_running_commands(tab) : std::vector<std::string>();
+            if (!running.empty() &&
+                !confirm_close("There is a process running in this terminal. Close anyway?", running)) {
+                return;  // Anuluj zamknięcie
             }
             
+            set_broadcast(tab, false);
+            for (GtkWidget *terminal : tab->all_terminals()) {
+                forget_broadcast_source(terminal);
+            }
             tabs.erase(tabs.begin() + tab_index);
             gtk_notebook_remove_page(GTK_NOTEBOOK(notebook), tab_index);
             delete tab;
             
-            // Jeśli nie ma więcej zakładek, zamknij aplikację
+            // Jeśli nie ma więcej zakładek, zamknij okno (sygnał destroy usuwa obiekt)
             if (tabs.empty()) {
-                // Dodaj nową zakładkę lub zamknij aplikację
                 if (gtk_notebook_get_n_pages(GTK_NOTEBOOK(notebook)) == 0) {
-                    gtk_main_quit();
+                    gtk_widget_destroy(window);
                 }
             } else if (tabs.size() == 1) {
                 // Ukryj pasek zakładek, gdy zostanie tylko jedna karta
@@ -1227,15 +5445,10 @@ private:
             config.font_size = gtk_range_get_value(GTK_RANGE(scale));
             
             // Zastosuj nowy rozmiar czcionki do wszystkich terminali
-            for (auto tab : tabs) {
-                PangoFontDescription *font_desc = pango_font_description_from_string(config.font_family.c_str());
-                pango_font_description_set_size(font_desc, (int)(config.font_size * PANGO_SCALE));
-                vte_terminal_set_font(VTE_TERMINAL(tab->terminal), font_desc);
-                pango_font_description_free(font_desc);
-            }
+            apply_font_to_all_terminals();
             
             // Zapisz konfigurację po zmianie
-            config.save_config();
+            config.mark_settings_dirty();
         }
         
         gtk_widget_destroy(dialog);
@@ -1257,15 +5470,13 @@ private:
             config.font_family = pango_font_description_get_family(font_desc);
             config.font_size = pango_font_description_get_size(font_desc) / PANGO_SCALE;
             
-            // Zastosuj nową czcionkę do wszystkich terminali
-            for (auto tab : tabs) {
-                vte_terminal_set_font(VTE_TERMINAL(tab->terminal), font_desc);
-            }
-            
             pango_font_description_free(font_desc);
             
+            // Zastosuj nową czcionkę do wszystkich terminali
+            apply_font_to_all_terminals();
+            
             // Zapisz konfigurację po zmianie
-            config.save_config();
+            config.mark_settings_dirty();
         }
         
         gtk_widget_destroy(dialog);
@@ -1355,7 +5566,8 @@ private:
             apply_theme_to_all_terminals();
             
             // Zapisz konfigurację po zmianie
-            config.save_config();
+            config.mark_theme_dirty(theme_name);
+            config.mark_settings_dirty();
         }
         
         gtk_widget_destroy(dialog);
@@ -1382,15 +5594,10 @@ private:
         if (config.font_size > 24.0) config.font_size = 24.0;
         
         // Zastosowanie nowego rozmiaru czcionki do wszystkich terminali
-        for (auto tab : tabs) {
-            PangoFontDescription *font_desc = pango_font_description_from_string(config.font_family.c_str());
-            pango_font_description_set_size(font_desc, (int)(config.font_size * PANGO_SCALE));
-            vte_terminal_set_font(VTE_TERMINAL(tab->terminal), font_desc);
-            pango_font_description_free(font_desc);
-        }
+        apply_font_to_all_terminals();
         
         // Zapisz konfigurację po zmianie
-        config.save_config();
+        config.mark_settings_dirty();
     }
     
     void reset_font_size() {
@@ -1398,15 +5605,10 @@ private:
         config.font_size = 11.0;
         
         // Zastosowanie domyślnego rozmiaru czcionki do wszystkich terminali
-        for (auto tab : tabs) {
-            PangoFontDescription *font_desc = pango_font_description_from_string(config.font_family.c_str());
-            pango_font_description_set_size(font_desc, (int)(config.font_size * PANGO_SCALE));
-            vte_terminal_set_font(VTE_TERMINAL(tab->terminal), font_desc);
-            pango_font_description_free(font_desc);
-        }
+        apply_font_to_all_terminals();
         
         // Zapisz konfigurację po zmianie
-        config.save_config();
+        config.mark_settings_dirty();
     }
     
     // Callbacks statyczne
@@ -1431,15 +5633,23 @@ private:
     static void on_terminal_exit(VteTerminal *terminal, int status, gpointer data) {
         TerminalWindow *self = static_cast<TerminalWindow*>(data);
         
-        // Znalezienie zakładki z tym terminalem
-        for (size_t i = 0; i < self->tabs.size(); i++) {
-            if (VTE_TERMINAL(self->tabs[i]->terminal) == terminal) {
-                self->close_tab(i);
-                break;
+        // Znalezienie zakładki z tym terminalem (także wśród paneli)
+        for (auto tab : self->tabs) {
+            for (GtkWidget *widget : tab->all_terminals()) {
+                if (VTE_TERMINAL(widget) == terminal) {
+                    self->close_pane(tab, widget, false);
+                    return;
+                }
             }
         }
     }
 
+    static gboolean on_terminal_focus_in(GtkWidget *widget, GdkEventFocus *event, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        tab->focused_terminal = widget;
+        return FALSE;
+    }
+
     static void on_title_changed(VteTerminal *terminal, gpointer data) {
         TerminalTab *tab = static_cast<TerminalTab*>(data);
         const char *title = vte_terminal_get_window_title(terminal);
@@ -1451,14 +5661,42 @@ private:
 
     static void on_tab_switch(GtkNotebook *notebook, GtkWidget *page, guint page_num, gpointer data) {
         TerminalWindow *self = static_cast<TerminalWindow*>(data);
-        if (page_num < self->tabs.size()) {
-            gtk_widget_grab_focus(self->tabs[page_num]->terminal);
+        if (page_num < self->tabs.size() && !self->restoring_tabs) {
+            TerminalTab *tab = self->tabs[page_num];
+            tab->last_viewed = g_get_monotonic_time();
+            self->materialize_tab(tab);
+            gtk_widget_grab_focus(tab->active_terminal());
+        }
+    }
+    
+    // Wektor tabs odpowiada kolejności stron notebooka, więc przeciąganie kart go aktualizuje
+    static void on_page_reordered(GtkNotebook *notebook, GtkWidget *child, guint page_num, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        auto it = std::find_if(self->tabs.begin(), self->tabs.end(),
+                               [child](TerminalTab *tab) { return tab->page == child; });
+        if (it == self->tabs.end() || page_num >= self->tabs.size()) return;
+        
+        TerminalTab *tab = *it;
+        self->tabs.erase(it);
+        self->tabs.insert(self->tabs.begin() + page_num, tab);
+    }
+    
+    // Uruchamia w tle po jednej zadeklarowanej zakładce na każdy przebieg pętli
+    static gboolean on_materialize_idle(gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        for (auto tab : self->tabs) {
+            if (!tab->terminal) {
+                self->materialize_tab(tab);
+                return G_SOURCE_CONTINUE;
+            }
         }
+        self->materialize_idle_id = 0;
+        return G_SOURCE_REMOVE;
     }
 
     static void on_search_clicked(GtkWidget *widget, gpointer data) {
         TerminalWindow *self = static_cast<TerminalWindow*>(data);
-        self->show_search_dialog();
+        self->show_search_bar();
     }
 
     static void on_theme_clicked(GtkWidget *widget, gpointer data) {
@@ -1497,7 +5735,6 @@ private:
         // Sprawdź, czy można bezpiecznie zamknąć okno
         if (self->can_close_window()) {
             // Pozwól na zamknięcie okna
-            gtk_main_quit();
             return FALSE;
         } else {
             // Anuluj zamknięcie okna
@@ -1505,117 +5742,244 @@ private:
         }
     }
 
-    static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
-        TerminalWindow *self = static_cast<TerminalWindow*>(data);
-        
-        // Ctrl+Shift+T - nowa zakładka
-        if ((event->state & (GDK_CONTROL_MASK | GDK_SHIFT_MASK)) == (GDK_CONTROL_MASK | GDK_SHIFT_MASK) && 
-            event->keyval == GDK_KEY_T) {
-            self->add_new_tab();
-            return TRUE;
+    // Zegar ramek istnieje dopiero po realizacji okna
+    static void on_window_realize_profile(GtkWidget *widget, gpointer data) {
+        GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(widget);
+        if (frame_clock) {
+            g_signal_connect(frame_clock, "after-paint", G_CALLBACK(on_first_frame_painted), NULL);
         }
+    }
+
+    static void on_first_frame_painted(GdkFrameClock *frame_clock, gpointer data) {
+        g_signal_handlers_disconnect_by_func(frame_clock, (gpointer)on_first_frame_painted, data);
+        StartupProfiler::mark_first_frame();
+    }
+
+    static void on_window_destroy(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
         
-        // Ctrl+Shift+W - zamknięcie zakładki
-        if ((event->state & (GDK_CONTROL_MASK | GDK_SHIFT_MASK)) == (GDK_CONTROL_MASK | GDK_SHIFT_MASK) && 
-            event->keyval == GDK_KEY_W) {
-            int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-            if (current_page >= 0) {
-                self->close_tab(current_page);
-            }
-            return TRUE;
+        if (self->materialize_idle_id != 0) {
+            g_source_remove(self->materialize_idle_id);
+            self->materialize_idle_id = 0;
         }
-        
-        // Ctrl+ - powiększenie czcionki
-        if ((event->state & GDK_CONTROL_MASK) && 
-            (event->keyval == GDK_KEY_plus || event->keyval == GDK_KEY_equal)) {
-            self->change_font_size(1);
-            return TRUE;
+        self->stop_all_tabs_search();
+        self->stop_match_count();
+        self->release_count_text();
+        delete self->match_counter;
+        self->match_counter = nullptr;
+        if (self->broadcast_im) {
+            g_signal_handlers_disconnect_by_data(self->broadcast_im, self);
+            gtk_im_context_set_client_window(self->broadcast_im, NULL);
+            g_object_unref(self->broadcast_im);
+            self->broadcast_im = nullptr;
+            self->broadcast_im_terminal = nullptr;
         }
-        
-        // Ctrl- - zmniejszenie czcionki
-        if ((event->state & GDK_CONTROL_MASK) && 
-            event->keyval == GDK_KEY_minus) {
-            self->change_font_size(-1);
-            return TRUE;
+        self->stop_replay();
+        self->release_latency_frame_clock();
+        
+        // Odłącz sygnały, żeby niszczone widgety nie odwoływały się do usuwanych obiektów
+        g_signal_handlers_disconnect_by_data(self->window, self);
+        g_signal_handlers_disconnect_by_data(self->notebook, self);
+        for (auto tab : self->tabs) {
+            for (GtkWidget *terminal : tab->all_terminals()) {
+                g_signal_handlers_disconnect_by_data(terminal, self);
+                g_signal_handlers_disconnect_by_data(terminal, tab);
+            }
         }
         
-        // Ctrl+0 - reset rozmiaru czcionki
-        if ((event->state & GDK_CONTROL_MASK) && 
-            event->keyval == GDK_KEY_0) {
-            self->reset_font_size();
-            return TRUE;
-        }
+        delete self;
+    }
+
+    static gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        gint64 key_time = g_get_monotonic_time();
         
-        // Ctrl+Shift+F - wyszukiwanie
-        if ((event->state & (GDK_CONTROL_MASK | GDK_SHIFT_MASK)) == (GDK_CONTROL_MASK | GDK_SHIFT_MASK) && 
-            event->keyval == GDK_KEY_F) {
-            self->show_search_dialog();
+        Keymap::Action action = self->config.keymap.lookup(event->state, event->keyval);
+        if (action != Keymap::Action::None && self->run_action(action)) {
             return TRUE;
         }
         
-        // Ctrl+Page_Down - następna zakładka
-        if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_Page_Down) {
-            int n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(self->notebook));
-            int current = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-            gtk_notebook_set_current_page(GTK_NOTEBOOK(self->notebook), (current + 1) % n_pages);
-            return TRUE;
+        // Klawisz nie jest skrótem - trafi do terminala bieżącej zakładki
+        if (!event->is_modifier) {
+            TerminalTab *tab = self->get_current_tab();
+            if (tab && tab->latency) {
+                tab->latency->key_pressed(key_time);
+            }
         }
         
-        // Ctrl+Page_Up - poprzednia zakładka
-        if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_Page_Up) {
-            int n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(self->notebook));
-            int current = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-            gtk_notebook_set_current_page(GTK_NOTEBOOK(self->notebook), (current + n_pages - 1) % n_pages);
-            return TRUE;
+        return FALSE;
+    }
+    
+    // Wykonuje akcję skrótu; false przepuszcza klawisz do terminala
+    bool run_action(Keymap::Action action) {
+        switch (action) {
+        case Keymap::Action::NewTab:
+            add_new_tab();
+            return true;
+        case Keymap::Action::ClosePane:
+            close_active_pane();
+            return true;
+        case Keymap::Action::SplitRight:
+            split_active_pane(GTK_ORIENTATION_HORIZONTAL);
+            return true;
+        case Keymap::Action::SplitDown:
+            split_active_pane(GTK_ORIENTATION_VERTICAL);
+            return true;
+        case Keymap::Action::FocusPaneLeft:
+            return focus_pane(-1, 0);
+        case Keymap::Action::FocusPaneRight:
+            return focus_pane(1, 0);
+        case Keymap::Action::FocusPaneUp:
+            return focus_pane(0, -1);
+        case Keymap::Action::FocusPaneDown:
+            return focus_pane(0, 1);
+        case Keymap::Action::NextTab:
+        case Keymap::Action::PreviousTab: {
+            int n_pages = gtk_notebook_get_n_pages(GTK_NOTEBOOK(notebook));
+            int current = gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook));
+            int step = action == Keymap::Action::NextTab ? 1 : n_pages - 1;
+            gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), (current + step) % n_pages);
+            return true;
         }
-        
-        // Ctrl+ + - powiększenie tekstu
-        if ((event->state & GDK_CONTROL_MASK) && (event->keyval == GDK_KEY_plus || event->keyval == GDK_KEY_equal)) {
-            int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-            if (current_page >= 0 && current_page < static_cast<int>(self->tabs.size())) {
-                VteTerminal *terminal = VTE_TERMINAL(self->tabs[current_page]->terminal);
+        case Keymap::Action::FontLarger:
+            change_font_size(1);
+            return true;
+        case Keymap::Action::FontSmaller:
+            change_font_size(-1);
+            return true;
+        case Keymap::Action::FontReset:
+            reset_font_size();
+            return true;
+        case Keymap::Action::ZoomIn:
+        case Keymap::Action::ZoomOut:
+        case Keymap::Action::ZoomReset: {
+            // Powiększenie tekstu tylko w aktywnym terminalu
+            TerminalTab *tab = get_current_tab();
+            if (tab && tab->terminal) {
+                VteTerminal *terminal = VTE_TERMINAL(tab->active_terminal());
                 double font_scale = vte_terminal_get_font_scale(terminal);
-                vte_terminal_set_font_scale(terminal, font_scale * 1.1);
+                if (action == Keymap::Action::ZoomIn) font_scale *= 1.1;
+                else if (action == Keymap::Action::ZoomOut) font_scale /= 1.1;
+                else font_scale = 1.0;
+                vte_terminal_set_font_scale(terminal, font_scale);
             }
-            return TRUE;
+            return true;
         }
-        
-        // Ctrl+ - - pomniejszenie tekstu
-        if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_minus) {
-            int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-            if (current_page >= 0 && current_page < static_cast<int>(self->tabs.size())) {
-                VteTerminal *terminal = VTE_TERMINAL(self->tabs[current_page]->terminal);
-                double font_scale = vte_terminal_get_font_scale(terminal);
-                vte_terminal_set_font_scale(terminal, font_scale / 1.1);
-            }
-            return TRUE;
+        case Keymap::Action::Search:
+            show_search_bar();
+            return true;
+        case Keymap::Action::ToggleBroadcast: {
+            TerminalTab *tab = get_current_tab();
+            if (!tab || tab->read_only) return false;
+            set_broadcast(tab, !tab->broadcast);
+            return true;
         }
-        
-        // Ctrl+0 - reset rozmiaru tekstu
-        if ((event->state & GDK_CONTROL_MASK) && event->keyval == GDK_KEY_0) {
-            int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-            if (current_page >= 0 && current_page < static_cast<int>(self->tabs.size())) {
-                VteTerminal *terminal = VTE_TERMINAL(self->tabs[current_page]->terminal);
-                vte_terminal_set_font_scale(terminal, 1.0);
+        case Keymap::Action::None:
+            break;
+        }
+        return false;
+    }
+    
+    static gboolean on_terminal_key_latency(GtkWidget *widget, GdkEventKey *event, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        if (!event->is_modifier) {
+            tab->latency->key_dispatched(g_get_monotonic_time());
+        }
+        return FALSE;
+    }
+    
+    static void on_contents_changed_latency(VteTerminal *terminal, gpointer data) {
+        TerminalTab *tab = static_cast<TerminalTab*>(data);
+        tab->latency->output_changed(g_get_monotonic_time());
+    }
+    
+    void release_latency_frame_clock() {
+        if (latency_frame_clock) {
+            g_signal_handlers_disconnect_by_data(latency_frame_clock, this);
+            g_object_unref(latency_frame_clock);
+            latency_frame_clock = nullptr;
+        }
+    }
+    
+    static void on_window_realize_latency(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(widget);
+        if (frame_clock && !self->latency_frame_clock) {
+            self->latency_frame_clock = GDK_FRAME_CLOCK(g_object_ref(frame_clock));
+            g_signal_connect(frame_clock, "after-paint", G_CALLBACK(on_latency_frame), self);
+        }
+    }
+    
+    // Echo jest na ekranie po pierwszej klatce narysowanej po zmianie zawartości
+    static void on_latency_frame(GdkFrameClock *frame_clock, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        gint64 now = g_get_monotonic_time();
+        for (auto tab : self->tabs) {
+            if (tab->latency && tab->latency->has_pending()) {
+                tab->latency->frame_painted(now);
             }
-            return TRUE;
         }
-        
-        return FALSE;
     }
-
-    // Funkcje pomocnicze dla menu kontekstowego
-    static void close_current_tab(GtkWidget *widget, gpointer data) {
+
+    // Funkcje pomocnicze dla menu kontekstowego
+    static void close_current_tab(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
+        if (current_page >= 0) {
+            self->close_tab(current_page);
+        }
+    }
+    
+    static void on_split_right(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->split_active_pane(GTK_ORIENTATION_HORIZONTAL);
+    }
+    
+    static void on_split_down(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->split_active_pane(GTK_ORIENTATION_VERTICAL);
+    }
+    
+    static void on_close_pane(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->close_active_pane();
+    }
+    
+    static void on_paste(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        GtkWidget *terminal = GTK_WIDGET(g_object_get_data(G_OBJECT(widget), "terminal"));
+        self->paste_selection(terminal, GDK_SELECTION_CLIPBOARD);
+    }
+    
+    static void on_broadcast_toggled(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        TerminalTab *tab = self->get_current_tab();
+        if (tab) {
+            self->set_broadcast(tab, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(widget)));
+        }
+    }
+    
+    static void on_broadcast_all(GtkWidget *widget, gpointer data) {
         TerminalWindow *self = static_cast<TerminalWindow*>(data);
-        int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(self->notebook));
-        if (current_page >= 0) {
-            self->close_tab(current_page);
+        self->set_broadcast_all(true);
+    }
+    
+    static void on_broadcast_stop(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        self->set_broadcast_all(false);
+    }
+    
+    static void on_show_spilled_scrollback(GtkWidget *widget, gpointer data) {
+        TerminalWindow *self = static_cast<TerminalWindow*>(data);
+        TerminalTab *tab = static_cast<TerminalTab*>(g_object_get_data(G_OBJECT(widget), "tab"));
+        if (std::find(self->tabs.begin(), self->tabs.end(), tab) != self->tabs.end()) {
+            self->show_spilled_scrollback(tab);
         }
     }
     
     static void show_search(GtkWidget *widget, gpointer data) {
         TerminalWindow *self = static_cast<TerminalWindow*>(data);
-        self->show_search_dialog();
+        self->show_search_bar();
     }
     
     static void show_theme_selector(GtkWidget *widget, gpointer data) {
@@ -1629,6 +5993,13 @@ private:
     }
     
     static gboolean on_right_click(GtkWidget *widget, GdkEventButton *event, gpointer data) {
+        if (event->button == 2 && event->type == GDK_BUTTON_PRESS) {
+            // Poza grupą rozgłaszania zaznaczenie wkleja VTE
+            TerminalWindow *self = static_cast<TerminalWindow*>(data);
+            if (!self->broadcast_source(widget)) return FALSE;
+            self->paste_selection(widget, GDK_SELECTION_PRIMARY);
+            return TRUE;
+        }
         if (event->button == 3) {
             TerminalWindow *self = static_cast<TerminalWindow*>(data);
             
@@ -1641,7 +6012,8 @@ private:
             
             // Wklejanie
             GtkWidget *item_paste = gtk_menu_item_new_with_label("Paste");
-            g_signal_connect(item_paste, "activate", G_CALLBACK(vte_terminal_paste_clipboard), widget);
+            g_object_set_data(G_OBJECT(item_paste), "terminal", widget);
+            g_signal_connect(item_paste, "activate", G_CALLBACK(on_paste), self);
             gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_paste);
             
             // Separator
@@ -1658,6 +6030,40 @@ private:
             g_signal_connect(item_close_tab, "activate", G_CALLBACK(close_current_tab), self);
             gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_close_tab);
             
+            // Podział na panele
+            GtkWidget *item_split_right = gtk_menu_item_new_with_label("Split Right");
+            g_signal_connect(item_split_right, "activate", G_CALLBACK(on_split_right), self);
+            gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_split_right);
+            
+            GtkWidget *item_split_down = gtk_menu_item_new_with_label("Split Down");
+            g_signal_connect(item_split_down, "activate", G_CALLBACK(on_split_down), self);
+            gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_split_down);
+            
+            TerminalTab *tab = self->get_current_tab();
+            if (tab && !tab->panes.empty()) {
+                GtkWidget *item_close_pane = gtk_menu_item_new_with_label("Close Pane");
+                g_signal_connect(item_close_pane, "activate", G_CALLBACK(on_close_pane), self);
+                gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_close_pane);
+            }
+            
+            // Rozgłaszanie wejścia
+            if (tab && !tab->read_only) {
+                GtkWidget *item_broadcast = gtk_check_menu_item_new_with_label("Broadcast Input");
+                gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item_broadcast), tab->broadcast);
+                g_signal_connect(item_broadcast, "toggled", G_CALLBACK(on_broadcast_toggled), self);
+                gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_broadcast);
+            }
+            
+            GtkWidget *item_broadcast_all = gtk_menu_item_new_with_label("Broadcast to All Tabs");
+            g_signal_connect(item_broadcast_all, "activate", G_CALLBACK(on_broadcast_all), self);
+            gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_broadcast_all);
+            
+            if (!self->broadcast_tabs.empty()) {
+                GtkWidget *item_broadcast_stop = gtk_menu_item_new_with_label("Stop Broadcasting");
+                g_signal_connect(item_broadcast_stop, "activate", G_CALLBACK(on_broadcast_stop), self);
+                gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_broadcast_stop);
+            }
+            
             // Separator
             separator = gtk_separator_menu_item_new();
             gtk_menu_shell_append(GTK_MENU_SHELL(menu), separator);
@@ -1667,6 +6073,16 @@ private:
             g_signal_connect(item_search, "activate", G_CALLBACK(show_search), self);
             gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_search);
             
+            // Historia zrzucona na dysk
+            for (auto tab : self->tabs) {
+                if (tab->terminal == widget && !tab->spill_files.empty()) {
+                    GtkWidget *item_spilled = gtk_menu_item_new_with_label("Show Saved Scrollback");
+                    g_object_set_data(G_OBJECT(item_spilled), "tab", tab);
+                    g_signal_connect(item_spilled, "activate", G_CALLBACK(on_show_spilled_scrollback), self);
+                    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item_spilled);
+                }
+            }
+            
             // Wybór motywu
             GtkWidget *item_theme = gtk_menu_item_new_with_label("Select Theme");
             g_signal_connect(item_theme, "activate", G_CALLBACK(show_theme_selector), self);
@@ -1685,21 +6101,632 @@ private:
     }
 };
 
+// Obserwuje katalog konfiguracji i motywów (GFileMonitor) i stosuje zmiany
+// bez restartu. Zmieniony plik jest parsowany ponownie i porównywany ze stanem
+// w pamięci - terminale są aktualizowane tylko wtedy, gdy coś faktycznie się
+// zmieniło, więc własne zapisy (TerminalConfig::save_config) niczego nie ruszają.
+class ConfigWatcher {
+public:
+    ConfigWatcher(TerminalConfig &config) : config(config), config_monitor(nullptr),
+                                            themes_monitor(nullptr), reload_timeout_id(0) {}
+
+    ~ConfigWatcher() {
+        stop();
+    }
+
+    void start() {
+        config_monitor = monitor_directory(TerminalConfig::get_config_dir());
+        themes_monitor = monitor_directory(TerminalConfig::get_themes_dir());
+    }
+
+    void stop() {
+        if (reload_timeout_id != 0) {
+            g_source_remove(reload_timeout_id);
+            reload_timeout_id = 0;
+        }
+        for (GFileMonitor **monitor : {&config_monitor, &themes_monitor}) {
+            if (*monitor) {
+                g_file_monitor_cancel(*monitor);
+                g_object_unref(*monitor);
+                *monitor = nullptr;
+            }
+        }
+    }
+
+private:
+    // Edytory często zapisują plik w kilku krokach, więc zdarzenia są zbierane przez chwilę
+    static constexpr guint RELOAD_DELAY_MS = 100;
+
+    TerminalConfig &config;
+    GFileMonitor *config_monitor;
+    GFileMonitor *themes_monitor;
+    guint reload_timeout_id;
+    std::set<std::string> changed_paths;
+
+    GFileMonitor *monitor_directory(const std::string &path) {
+        GError *error = NULL;
+        GFile *directory = g_file_new_for_path(path.c_str());
+        GFileMonitor *monitor = g_file_monitor_directory(directory, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+        g_object_unref(directory);
+        
+        if (monitor == NULL) {
+            std::cerr << "Cannot watch " << path << ": " << error->message << std::endl;
+            g_error_free(error);
+            return nullptr;
+        }
+        
+        g_signal_connect(monitor, "changed", G_CALLBACK(on_file_changed), this);
+        return monitor;
+    }
+
+    static void on_file_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                GFileMonitorEvent event_type, gpointer data) {
+        ConfigWatcher *self = static_cast<ConfigWatcher*>(data);
+        
+        // Przy zapisie przez rename (także nasz write_file_atomically) nowa treść ma nazwę other_file
+        GFile *target = NULL;
+        switch (event_type) {
+            case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+            case G_FILE_MONITOR_EVENT_CREATED:
+            case G_FILE_MONITOR_EVENT_MOVED_IN:
+                target = file;
+                break;
+            case G_FILE_MONITOR_EVENT_RENAMED:
+                target = other_file;
+                break;
+            default:
+                return;
+        }
+        if (target == NULL) return;
+        
+        gchar *path = g_file_get_path(target);
+        if (path) {
+            self->changed_paths.insert(path);
+            g_free(path);
+        }
+        
+        if (self->reload_timeout_id == 0) {
+            self->reload_timeout_id = g_timeout_add(RELOAD_DELAY_MS, on_reload_timeout, self);
+        }
+    }
+
+    static gboolean on_reload_timeout(gpointer data) {
+        ConfigWatcher *self = static_cast<ConfigWatcher*>(data);
+        self->reload_timeout_id = 0;
+        
+        std::set<std::string> paths;
+        paths.swap(self->changed_paths);
+        
+        std::string themes_prefix = TerminalConfig::get_themes_dir() + "/";
+        for (const auto &path : paths) {
+            if (path == TerminalConfig::get_config_path()) {
+                self->reload_settings();
+            } else if (path.compare(0, themes_prefix.size(), themes_prefix) == 0 &&
+                       path.size() > 6 && path.compare(path.size() - 6, 6, ".theme") == 0) {
+                self->reload_theme(path);
+            }
+        }
+        return G_SOURCE_REMOVE;
+    }
+
+    void reload_settings() {
+        // Niezapisane jeszcze zmiany z interfejsu mają pierwszeństwo przed plikiem
+        if (config.is_settings_dirty()) return;
+        
+        TerminalConfig fresh;
+        if (!fresh.load_settings()) return;
+        
+        bool font_changed = fresh.font_family != config.font_family || fresh.font_size != config.font_size;
+        bool theme_changed = fresh.current_theme_name != config.current_theme_name ||
+                             fresh.transparency != config.transparency || fresh.render_path != config.render_path;
+        bool scrollback_changed = fresh.scrollback_lines != config.scrollback_lines ||
+                                  fresh.scrollback_budget_mb != config.scrollback_budget_mb ||
+                                  fresh.scrollback_spill_minutes != config.scrollback_spill_minutes;
+        
+        if (font_changed) {
+            config.font_family = fresh.font_family;
+            config.font_size = fresh.font_size;
+            TerminalWindow::apply_font_to_all_terminals();
+        }
+        
+        if (theme_changed) {
+            config.transparency = fresh.transparency;
+            config.render_path = fresh.render_path;
+            if (config.color_themes.find(fresh.current_theme_name) == config.color_themes.end()) {
+                config.ensure_all_themes_loaded();
+            }
+            config.current_theme_name = fresh.current_theme_name;
+            TerminalWindow::apply_theme_to_all_terminals();
+        }
+        
+        if (scrollback_changed) {
+            config.scrollback_lines = fresh.scrollback_lines;
+            config.scrollback_budget_mb = fresh.scrollback_budget_mb;
+            config.scrollback_spill_minutes = fresh.scrollback_spill_minutes;
+            TerminalWindow::apply_scrollback_to_all_terminals();
+        }
+        
+        bool keys_changed = fresh.keybindings != config.keybindings;
+        if (keys_changed) {
+            config.keybindings = fresh.keybindings;
+            config.compile_keymap();
+        }
+        
+        bool monitor_changed = fresh.process_monitor_seconds != config.process_monitor_seconds;
+        if (monitor_changed) {
+            config.process_monitor_seconds = fresh.process_monitor_seconds;
+            TerminalWindow::apply_process_monitor();
+        }
+        
+        if (font_changed || theme_changed || scrollback_changed || monitor_changed || keys_changed) {
+            std::cerr << "Configuration reloaded from " << TerminalConfig::get_config_path() << std::endl;
+        }
+    }
+
+    void reload_theme(const std::string &path) {
+        ColorTheme theme;
+        if (!TerminalConfig::parse_theme_file(path, config.transparency, theme) || theme.name.empty()) {
+            return;
+        }
+        if (config.is_theme_dirty(theme.name)) return;
+        
+        auto it = config.color_themes.find(theme.name);
+        if (it != config.color_themes.end() && same_colors(it->second, theme)) {
+            return;
+        }
+        
+        config.color_themes[theme.name] = theme;
+        std::cerr << "Motyw przeładowany: " << theme.name << std::endl;
+        
+        // Pozostałe motywy nie są nigdzie wyświetlane, więc terminali nie trzeba ruszać
+        if (theme.name == config.current_theme_name) {
+            TerminalWindow::apply_theme_to_all_terminals();
+        }
+    }
+
+    static bool same_colors(const ColorTheme &a, const ColorTheme &b) {
+        auto same = [](const GdkRGBA &x, const GdkRGBA &y) {
+            return x.red == y.red && x.green == y.green && x.blue == y.blue && x.alpha == y.alpha;
+        };
+        
+        if (!same(a.foreground, b.foreground) || !same(a.background, b.background)) {
+            return false;
+        }
+        for (int i = 0; i < 16; i++) {
+            if (!same(a.palette[i], b.palette[i])) return false;
+        }
+        return true;
+    }
+};
+
+// Serwer pojedynczej instancji. Pierwszy proces nasłuchuje na gnieździe unix,
+// a kolejne wywołania lum-terminal przekazują mu swoje argumenty i od razu kończą
+// działanie, więc nowe okno nie płaci za gtk_init, wczytanie konfiguracji i motywów.
+//
+// Protokół: jedna linia na żądanie, argumenty rozdzielone tabulatorem i zakodowane
+// przez g_strescape, np. "new-window\t/home/user". Odpowiedź to "ok" lub "error <opis>".
+//
+// To samo gniazdo obsługuje control API dla skryptów (lum-terminal --control):
+//   list                       -> ok, potem id, tytuł i katalog każdej zakładki
+//   open <katalog> [<arg>...]  -> ok <id>; bez argumentów startuje powłoka
+//   send <id> <tekst>          -> ok; tekst trafia do programu jak wpisany z klawiatury
+//   read <id> [visible|scrollback]
+//                              -> ok <tekst>
+//   close <id>                 -> ok; bez pytania o uruchomione procesy
+// Pola odpowiedzi są kodowane tak jak żądania. Wiele żądań można wysłać naraz -
+// odpowiedzi przychodzą w tej samej kolejności. Zamiast id można podać %N,
+// czyli zakładkę otwartą przez N-te "open" tego połączenia, więc jedna porcja
+// żądań może otworzyć zakładki i od razu nimi sterować.
+class InstanceServer {
+public:
+    InstanceServer(TerminalConfig &config) : config(config), service(nullptr) {}
+
+    ~InstanceServer() {
+        stop();
+    }
+
+    // Gniazdo jest osobne dla każdego wyświetlacza, bo okna otwiera proces serwera
+    static std::string get_socket_path() {
+        const char *display = getenv("WAYLAND_DISPLAY");
+        if (display == nullptr || *display == '\0') {
+            display = getenv("DISPLAY");
+        }
+        
+        std::string suffix = display ? display : "default";
+        for (char &c : suffix) {
+            if (!g_ascii_isalnum(c)) c = '_';
+        }
+        
+        return std::string(g_get_user_runtime_dir()) + "/lum-terminal-" + suffix + ".sock";
+    }
+
+    // Strona klienta: czyste wywołania POSIX bez inicjalizacji GTK, żeby proces
+    // kończył się w kilka milisekund. Zwraca true, jeśli działający proces przyjął żądanie.
+    static bool forward_to_running_instance(const std::vector<std::string> &args) {
+        int fd = connect_to_socket(get_socket_path());
+        if (fd < 0) {
+            return false;
+        }
+        
+        // Zawieszony serwer nie może zablokować klienta - po czasie startujemy samodzielnie
+        struct timeval timeout = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        
+        std::string request = encode_request(args);
+        bool sent = write_all(fd, request.data(), request.size());
+        
+        char reply[256];
+        ssize_t bytes_read = sent ? read(fd, reply, sizeof(reply) - 1) : -1;
+        close(fd);
+        
+        if (bytes_read <= 0) {
+            return false;
+        }
+        reply[bytes_read] = '\0';
+        
+        if (strncmp(reply, "ok", 2) != 0) {
+            std::cerr << "Running instance rejected request: " << reply;
+            return false;
+        }
+        return true;
+    }
+
+    // lum-terminal --control: wysyła wszystkie linie ze standardowego wejścia
+    // jedną porcją i wypisuje odpowiedzi. Kod wyjścia 1, gdy któraś jest błędem.
+    static int run_control_client() {
+        int fd = connect_to_socket(get_socket_path());
+        if (fd < 0) {
+            std::cerr << "No running Lum Terminal instance at " << get_socket_path() << std::endl;
+            return 1;
+        }
+        
+        std::string requests;
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (line.empty()) continue;
+            requests += line;
+            requests += '\n';
+        }
+        
+        // Zamknięcie strony zapisu mówi serwerowi, że porcja się skończyła
+        bool sent = write_all(fd, requests.data(), requests.size());
+        shutdown(fd, SHUT_WR);
+        
+        std::string replies;
+        char buffer[65536];
+        while (sent) {
+            ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+            if (bytes_read < 0 && errno == EINTR) continue;
+            if (bytes_read <= 0) break;
+            replies.append(buffer, bytes_read);
+        }
+        close(fd);
+        
+        std::cout << replies << std::flush;
+        
+        bool ok = sent;
+        size_t start = 0;
+        while (start < replies.size()) {
+            if (replies.compare(start, 2, "ok") != 0) ok = false;
+            size_t end = replies.find('\n', start);
+            start = end == std::string::npos ? replies.size() : end + 1;
+        }
+        return ok ? 0 : 1;
+    }
+
+    // Strona serwera: nasłuchiwanie w pętli GTK przez GSocketService
+    bool start() {
+        std::string path = get_socket_path();
+        
+        // Usuń pozostałość po procesie, który nie zamknął się poprawnie
+        if (access(path.c_str(), F_OK) == 0 && !is_alive(path)) {
+            unlink(path.c_str());
+        }
+        
+        GError *error = NULL;
+        GSocketAddress *address = g_unix_socket_address_new(path.c_str());
+        service = g_socket_service_new();
+        
+        gboolean added = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                                       G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                                       NULL, NULL, &error);
+        g_object_unref(address);
+        
+        if (!added) {
+            // Inny proces właśnie zajął gniazdo - działamy dalej jako osobna instancja
+            std::cerr << "Cannot start instance server on " << path << ": " << error->message << std::endl;
+            g_error_free(error);
+            g_object_unref(service);
+            service = nullptr;
+            return false;
+        }
+        
+        chmod(path.c_str(), 0600);
+        socket_path = path;
+        g_signal_connect(service, "incoming", G_CALLBACK(on_incoming), this);
+        g_socket_service_start(service);
+        return true;
+    }
+
+    void stop() {
+        if (service) {
+            g_socket_service_stop(service);
+            g_socket_listener_close(G_SOCKET_LISTENER(service));
+            g_object_unref(service);
+            service = nullptr;
+            unlink(socket_path.c_str());
+        }
+    }
+
+    static std::string encode_request(const std::vector<std::string> &args) {
+        std::string request;
+        for (size_t i = 0; i < args.size(); i++) {
+            gchar *escaped = g_strescape(args[i].c_str(), NULL);
+            if (i > 0) request += '\t';
+            request += escaped;
+            g_free(escaped);
+        }
+        request += '\n';
+        return request;
+    }
+
+    static std::vector<std::string> decode_request(const char *line) {
+        std::vector<std::string> args;
+        gchar **parts = g_strsplit(line, "\t", -1);
+        for (gchar **part = parts; *part; part++) {
+            gchar *unescaped = g_strcompress(*part);
+            args.push_back(unescaped);
+            g_free(unescaped);
+        }
+        g_strfreev(parts);
+        return args;
+    }
+
+private:
+    // Stan pojedynczego połączenia klienta
+    struct ClientConnection {
+        InstanceServer *server;
+        GSocketConnection *connection;
+        GDataInputStream *input;
+        std::string reply;
+        std::vector<unsigned> opened;  // zakładki otwarte przez "open", dla odwołań %N
+    };
+
+    TerminalConfig &config;
+    GSocketService *service;
+    std::string socket_path;
+
+    static bool write_all(int fd, const char *data, size_t size) {
+        while (size > 0) {
+            ssize_t written = write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    // Deskryptor połączonego gniazda albo -1
+    static int connect_to_socket(const std::string &path) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static bool is_alive(const std::string &path) {
+        int fd = connect_to_socket(path);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return true;
+    }
+    
+    // Identyfikator zakładki albo %N (N-te "open" tego połączenia); 0, gdy niepoprawny
+    static unsigned resolve_tab_id(const std::string &arg, const std::vector<unsigned> &opened) {
+        bool reference = !arg.empty() && arg[0] == '%';
+        guint64 number = 0;
+        if (!g_ascii_string_to_unsigned(arg.c_str() + (reference ? 1 : 0), 10, 1, G_MAXUINT, &number, NULL)) {
+            return 0;
+        }
+        if (reference) {
+            return number <= opened.size() ? opened[number - 1] : 0;
+        }
+        return (unsigned)number;
+    }
+
+    std::string handle_request(const std::vector<std::string> &args, std::vector<unsigned> &opened) {
+        if (args.empty()) {
+            return "error empty request\n";
+        }
+        
+        if (args[0] == "new-window") {
+            // new-window <katalog> [<katalog dodatkowej zakładki>...]
+            std::string working_directory = args.size() > 1 ? args[1] : "";
+            std::vector<std::string> extra_tabs;
+            if (args.size() > 2) {
+                extra_tabs.assign(args.begin() + 2, args.end());
+            }
+            TerminalWindow *window = new TerminalWindow(config, working_directory, extra_tabs);
+            window->present();
+            return "ok\n";
+        }
+        
+        if (args[0] == "restore") {
+            if (!TerminalWindow::restore_session(config)) {
+                std::string working_directory = args.size() > 1 ? args[1] : "";
+                (new TerminalWindow(config, working_directory))->present();
+            }
+            return "ok\n";
+        }
+        
+        if (args[0] == "list") {
+            std::vector<std::string> reply = TerminalWindow::control_list();
+            reply.insert(reply.begin(), "ok");
+            return encode_request(reply);
+        }
+        
+        if (args[0] == "open") {
+            // open <katalog> [<polecenie> <argumenty>...]
+            std::string working_directory = args.size() > 1 ? args[1] : "";
+            std::vector<std::string> command;
+            if (args.size() > 2) {
+                command.assign(args.begin() + 2, args.end());
+            }
+            unsigned id = TerminalWindow::control_open(working_directory, command);
+            if (id == 0) {
+                return "error no window to open the tab in\n";
+            }
+            opened.push_back(id);
+            return encode_request({"ok", std::to_string(id)});
+        }
+        
+        if (args[0] == "send" || args[0] == "read" || args[0] == "close") {
+            unsigned id = args.size() > 1 ? resolve_tab_id(args[1], opened) : 0;
+            if (id == 0) {
+                return "error " + args[0] + " needs a tab id\n";
+            }
+            
+            if (args[0] == "send") {
+                if (args.size() != 3) {
+                    return "error send needs a tab id and text\n";
+                }
+                if (!TerminalWindow::control_send(id, args[2])) {
+                    return "error no tab " + std::to_string(id) + " accepting input\n";
+                }
+                return "ok\n";
+            }
+            
+            if (args[0] == "read") {
+                std::string mode = args.size() > 2 ? args[2] : "visible";
+                if (mode != "visible" && mode != "scrollback") {
+                    return "error read mode must be visible or scrollback\n";
+                }
+                std::string text;
+                if (!TerminalWindow::control_read(id, mode == "scrollback", text)) {
+                    return "error no tab " + std::to_string(id) + "\n";
+                }
+                return encode_request({"ok", text});
+            }
+            
+            if (!TerminalWindow::control_close(id)) {
+                return "error no tab " + std::to_string(id) + "\n";
+            }
+            return "ok\n";
+        }
+        
+        return "error unknown command " + args[0] + "\n";
+    }
+
+    static gboolean on_incoming(GSocketService *service, GSocketConnection *connection,
+                                GObject *source_object, gpointer data) {
+        InstanceServer *self = static_cast<InstanceServer*>(data);
+        
+        ClientConnection *client = new ClientConnection();
+        client->server = self;
+        client->connection = G_SOCKET_CONNECTION(g_object_ref(connection));
+        client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+        read_next_request(client);
+        return TRUE;
+    }
+
+    static void read_next_request(ClientConnection *client) {
+        g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, NULL, on_request_read, client);
+    }
+
+    static void on_request_read(GObject *source, GAsyncResult *result, gpointer data) {
+        ClientConnection *client = static_cast<ClientConnection*>(data);
+        
+        GError *error = NULL;
+        gchar *line = g_data_input_stream_read_line_finish(G_DATA_INPUT_STREAM(source), result, NULL, &error);
+        if (line == NULL) {
+            // Klient zamknął połączenie albo wystąpił błąd odczytu
+            if (error) {
+                g_error_free(error);
+            }
+            close_client(client);
+            return;
+        }
+        
+        client->reply = client->server->handle_request(decode_request(line), client->opened);
+        g_free(line);
+        
+        GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+        g_output_stream_write_all_async(output, client->reply.data(), client->reply.size(),
+                                        G_PRIORITY_DEFAULT, NULL, on_reply_written, client);
+    }
+
+    static void on_reply_written(GObject *source, GAsyncResult *result, gpointer data) {
+        ClientConnection *client = static_cast<ClientConnection*>(data);
+        
+        if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, NULL)) {
+            close_client(client);
+            return;
+        }
+        read_next_request(client);
+    }
+
+    static void close_client(ClientConnection *client) {
+        g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+        g_object_unref(client->input);
+        g_object_unref(client->connection);
+        delete client;
+    }
+};
+
 int main(int argc, char *argv[]) {
+    StartupProfiler::set_origin(g_get_monotonic_time());
+    
     // Dodanie obsługi argumentów wiersza poleceń
     gboolean version = FALSE;
     gboolean help = FALSE;
+    gboolean standalone = FALSE;
+    gboolean profile_startup = FALSE;
+    gchar *profile_format = NULL;
+    gchar **tab_directories = NULL;
+    gboolean restore = FALSE;
+    gchar *replay_path = NULL;
+    gboolean replay_fast = FALSE;
+    gboolean headless = FALSE;
+    gboolean control = FALSE;
     
     GOptionEntry entries[] = {
         { "version", 'v', 0, G_OPTION_ARG_NONE, &version, "Show version information", NULL },
         { "help", 'h', 0, G_OPTION_ARG_NONE, &help, "Show help", NULL },
+        { "standalone", 's', 0, G_OPTION_ARG_NONE, &standalone, "Run in a new process instead of opening a window in the running one", NULL },
+        { "profile-startup", 0, 0, G_OPTION_ARG_NONE, &profile_startup, "Print timings of startup phases (implies --standalone)", NULL },
+        { "profile-format", 0, 0, G_OPTION_ARG_STRING, &profile_format, "Startup profile output: table (stderr) or json (stdout)", "FORMAT" },
+        { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_path, "Play back an asciicast recording in a new window (implies --standalone)", "FILE" },
+        { "replay-fast", 0, 0, G_OPTION_ARG_NONE, &replay_fast, "Play back as fast as possible, print throughput and quit", NULL },
+        { "headless", 0, 0, G_OPTION_ARG_NONE, &headless, "Render the replay in an offscreen window and quit after the report (use with --replay)", NULL },
+        { "restore", 'r', 0, G_OPTION_ARG_NONE, &restore, "Restore the tabs and windows of the previous session", NULL },
+        { "tab", 't', 0, G_OPTION_ARG_FILENAME_ARRAY, &tab_directories, "Open an extra tab in DIR, started when first shown (can be repeated)", "DIR" },
+        { "control", 0, 0, G_OPTION_ARG_NONE, &control, "Send control requests from standard input to the running instance and print the replies", NULL },
         { NULL }
     };
     
+    gint64 parse_start = g_get_monotonic_time();
     GError *error = NULL;
     GOptionContext *context = g_option_context_new("- Lum Terminal");
     g_option_context_add_main_entries(context, entries, NULL);
-    g_option_context_add_group(context, gtk_get_option_group(TRUE));
+    // Wyświetlacz otwiera dopiero gtk_init, żeby klient serwera go nie potrzebował
+    g_option_context_add_group(context, gtk_get_option_group(FALSE));
     
     if (!g_option_context_parse(context, &argc, &argv, &error)) {
         g_print("Option parsing failed: %s\n", error->message);
@@ -1719,7 +6746,98 @@ int main(int argc, char *argv[]) {
     
     g_option_context_free(context);
     
-    // Uruchomienie aplikacji
-    TerminalWindow terminal_window;
+    // Klient control API nie otwiera wyświetlacza ani okna
+    if (control) {
+        return InstanceServer::run_control_client();
+    }
+    
+    if (profile_format && strcmp(profile_format, "table") != 0 && strcmp(profile_format, "json") != 0) {
+        g_printerr("Unknown --profile-format '%s' (expected table or json)\n", profile_format);
+        g_free(profile_format);
+        return 1;
+    }
+    
+    if (profile_startup) {
+        StartupProfiler::enable(profile_format && strcmp(profile_format, "json") == 0);
+        StartupProfiler::record("GOption parsing", parse_start, g_get_monotonic_time());
+        // Profilujemy pełny zimny start, a nie przekazanie żądania do serwera
+        standalone = TRUE;
+    }
+    g_free(profile_format);
+    
+    // Odtwarzanie nagrania jest pomiarem tego procesu, nie przekazujemy go serwerowi
+    Asciicast::Recording recording;
+    if (replay_path) {
+        std::string load_error;
+        if (!Asciicast::load(replay_path, recording, load_error)) {
+            g_printerr("Cannot replay %s: %s\n", replay_path, load_error.c_str());
+            return 1;
+        }
+        standalone = TRUE;
+    } else if (headless) {
+        g_printerr("--headless needs --replay FILE\n");
+        return 1;
+    }
+    
+    // Ścieżki względne rozwiązujemy tutaj, bo serwer ma inny katalog bieżący
+    std::vector<std::string> extra_tabs;
+    for (gchar **directory = tab_directories; directory && *directory; directory++) {
+        extra_tabs.push_back(std::filesystem::absolute(*directory).string());
+    }
+    g_strfreev(tab_directories);
+    
+    // Przekazanie żądania do już działającego procesu
+    if (!standalone) {
+        gchar *cwd = g_get_current_dir();
+        std::vector<std::string> request = {restore ? "restore" : "new-window", cwd};
+        if (!restore) {
+            request.insert(request.end(), extra_tabs.begin(), extra_tabs.end());
+        }
+        bool forwarded = InstanceServer::forward_to_running_instance(request);
+        g_free(cwd);
+        if (forwarded) {
+            return 0;
+        }
+    }
+    
+    // Inicjalizacja GTK
+    {
+        StartupProfiler::Scope profile("gtk_init");
+        gtk_init(nullptr, nullptr);
+    }
+    
+    // Wczytanie konfiguracji wspólnej dla wszystkich okien
+    TerminalConfig config;
+    {
+        StartupProfiler::Scope profile("TerminalConfig::load_config");
+        config.load_config();
+    }
+    
+    if (config.latency_probe) {
+        g_unix_signal_add(SIGUSR1, TerminalWindow::on_latency_dump_signal, nullptr);
+    }
+    
+    InstanceServer server(config);
+    if (!standalone) {
+        server.start();
+    }
+    
+    // Zmiany config.ini i plików motywów są stosowane na bieżąco
+    ConfigWatcher watcher(config);
+    watcher.start();
+    
+    // Uruchomienie aplikacji - okno usuwa się samo po zamknięciu
+    if (replay_path) {
+        new TerminalWindow(config, replay_path, std::move(recording), replay_fast, headless);
+        g_free(replay_path);
+    } else if (!restore || !TerminalWindow::restore_session(config)) {
+        new TerminalWindow(config, "", extra_tabs);
+    }
+    gtk_main();
+    
+    watcher.stop();
+    server.stop();
+    OutputRecorder::shutdown();
+    ProcessMonitor::stop();
     return 0;
 }